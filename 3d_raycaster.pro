@@ -23,44 +23,25 @@ DEFINES += QT_DEPRECATED_WARNINGS
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 
+include(raycaster.pri)
+
 SOURCES += \
     src/main.cpp \
     src/mainwindow.cpp \
     src/trackball.cpp \
     src/raycastcanvas.cpp \
-    src/mesh.cpp \
-    src/osvolume.cpp \
-    src/raycastvolume.cpp \
-    src/polygon.cpp \
     src/my_q_slider.cpp \
-    src/plane.cpp \
 
 
 HEADERS += \
     src/mainwindow.h \
     src/trackball.h \
     src/raycastcanvas.h \
-    src/mesh.h \
-    src/osvolume.h \
-    src/polygon.h \
     src/my_q_slider.h \
     src/my_combo_box.h \
     src/my_button.h \
-    src/plane.h \
-
-INCLUDEPATH += \
-    src
 
 FORMS += \
     mainwindow.ui
 
-RESOURCES += \
-    resources.qrc
-
 DISTFILES +=
-
-gcc:QMAKE_CXXFLAGS += -std=c++17
-gcc:QMAKE_CXXFLAGS_RELEASE += -fopenmp -Ofast
-gcc:LIBS += -fopenmp -L/usr/local/lib -lopenslide -lGL -lGLU
-
-msvc:QMAKE_CXXFLAGS_RELEASE += /openmp /O2
@@ -0,0 +1,27 @@
+#-------------------------------------------------
+#
+# Headless renderer: draws a slide offscreen from a scene description and
+# writes PNG frames, with the same volume and shaders as 3d_raycaster.
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = 3d_raycaster_render
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(raycaster.pri)
+
+SOURCES += \
+    src/render_main.cpp \
+    src/offscreenrenderer.cpp \
+    src/renderscene.cpp \
+
+
+HEADERS += \
+    src/offscreenrenderer.h \
+    src/renderscene.h \
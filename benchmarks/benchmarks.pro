@@ -0,0 +1,11 @@
+#-------------------------------------------------
+#
+# Microbenchmarks; run each with its -median or
+# -iterations options, see README.md.
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    upload \
@@ -0,0 +1,120 @@
+#include <QtTest>
+
+#include <algorithm>
+#include <memory>
+
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+
+#include "osvolume.h"
+#include "texturestream.h"
+
+/*!
+ * \brief Times a full upload of the volume's base level, as SharedVolume
+ * stages it, in the two layouts the volume texture has used: openslide's
+ * premultiplied ARGB words, reordered by the driver from
+ * GL_UNSIGNED_INT_8_8_8_8, and straight RGBA bytes from convert_to_rgba8(),
+ * taken as GL_UNSIGNED_BYTE.
+ *
+ * Each iteration copies the slide region, as openslide writes it, stages it
+ * through TextureStream's pixel unpack buffers and waits for the transfer.
+ * Needs an OpenGL 3.3 context; skipped otherwise.
+ */
+class BenchUpload : public QObject, protected QOpenGLExtraFunctions
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void packed_argb();
+    void rgba8();
+
+private:
+    static const int WIDTH = 1024;
+    static const int HEIGHT = 1024;
+    static const int DEPTH = 4;
+
+    void upload(GLenum type, const std::vector<uint32_t>& pixels);
+
+    QOffscreenSurface m_surface;
+    QOpenGLContext m_context;
+    std::unique_ptr<TextureStream> m_texture;
+    std::vector<uint32_t> m_region;     /*!< Premultiplied ARGB, as openslide returns it. */
+};
+
+void BenchUpload::initTestCase()
+{
+    QSurfaceFormat format;
+    format.setVersion(3, 3);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    m_surface.setFormat(format);
+    m_surface.create();
+    m_context.setFormat(format);
+    if (!m_context.create() || !m_context.makeCurrent(&m_surface)
+            || m_context.format().version() < qMakePair(3, 3)) {
+        QSKIP("No OpenGL 3.3 context");
+    }
+    initializeOpenGLFunctions();
+    m_texture = std::make_unique<TextureStream>(GL_TEXTURE_3D, GL_LINEAR, GL_REPEAT);
+
+    // tissue of varying colour, with a transparent margin as outside the slide
+    m_region.resize((size_t) WIDTH * HEIGHT);
+    for (int y = 0; y < HEIGHT; y++) {
+        for (int x = 0; x < WIDTH; x++) {
+            const uint32_t a = x < 64 ? 0 : 255;
+            const uint32_t r = (x * 7 + y) & 0xff, g = (x + y * 3) & 0xff, b = (x ^ y) & 0xff;
+            m_region[(size_t) y * WIDTH + x] = (a << 24) | (r * a / 255 << 16) | (g * a / 255 << 8) | (b * a / 255);
+        }
+    }
+}
+
+void BenchUpload::cleanupTestCase()
+{
+    m_texture.reset();
+    m_context.doneCurrent();
+}
+
+/*!
+ * \brief Stage a full upload, every slice reading the same image, and wait
+ * for it to reach the texture.
+ */
+void BenchUpload::upload(GLenum type, const std::vector<uint32_t>& pixels)
+{
+    m_texture->begin(GL_RGBA8, WIDTH, HEIGHT, DEPTH);
+    m_texture->upload(0, 0, 0, 0, WIDTH, HEIGHT, DEPTH, GL_RGBA, type, pixels.data(),
+                      WIDTH, TextureStream::REPEAT_SLICE);
+    m_texture->end();
+    glFinish();
+    m_texture->texture();
+}
+
+/*!
+ * \brief Before: the words as they are, converted by the driver.
+ */
+void BenchUpload::packed_argb()
+{
+    std::vector<uint32_t> pixels(m_region.size());
+    QBENCHMARK {
+        std::copy(m_region.begin(), m_region.end(), pixels.begin());
+        upload(GL_UNSIGNED_INT_8_8_8_8, pixels);
+    }
+}
+
+/*!
+ * \brief After: converted in place on the CPU, then copied as they are.
+ */
+void BenchUpload::rgba8()
+{
+    std::vector<uint32_t> pixels(m_region.size());
+    QBENCHMARK {
+        std::copy(m_region.begin(), m_region.end(), pixels.begin());
+        convert_to_rgba8(pixels.data(), pixels.size());
+        upload(GL_UNSIGNED_BYTE, pixels);
+    }
+}
+
+QTEST_MAIN(BenchUpload)
+
+#include "bench_upload.moc"
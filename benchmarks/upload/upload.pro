@@ -0,0 +1,19 @@
+QT       += testlib gui
+
+TARGET = bench_upload
+CONFIG += console
+CONFIG -= app_bundle
+
+gcc:QMAKE_CXXFLAGS += -std=c++17 -fopenmp
+gcc:LIBS += -fopenmp -L/usr/local/lib -lopenslide -lGL
+
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    bench_upload.cpp \
+    ../../src/osvolume.cpp \
+    ../../src/texturestream.cpp \
+
+HEADERS += \
+    ../../src/osvolume.h \
+    ../../src/texturestream.h \
@@ -0,0 +1,49 @@
+# Sources shared by the interactive app and the headless renderer: the
+# volume, its TFs, the raycasting shaders and their CPU counterpart.
+
+SOURCES += \
+    $$PWD/src/mesh.cpp \
+    $$PWD/src/osvolume.cpp \
+    $$PWD/src/raycastvolume.cpp \
+    $$PWD/src/polygon.cpp \
+    $$PWD/src/plane.cpp \
+    $$PWD/src/sharedvolume.cpp \
+    $$PWD/src/texturestream.cpp \
+    $$PWD/src/tfbaker.cpp \
+    $$PWD/src/tfcache.cpp \
+    $$PWD/src/tfcompute.cpp \
+    $$PWD/src/coloroccupancy.cpp \
+    $$PWD/src/annotations.cpp \
+    $$PWD/src/cpuraycaster.cpp \
+
+
+HEADERS += \
+    $$PWD/src/mesh.h \
+    $$PWD/src/osvolume.h \
+    $$PWD/src/polygon.h \
+    $$PWD/src/plane.h \
+    $$PWD/src/raycastview.h \
+    $$PWD/src/raycastvolume.h \
+    $$PWD/src/sharedvolume.h \
+    $$PWD/src/texturestream.h \
+    $$PWD/src/tfbaker.h \
+    $$PWD/src/tfcache.h \
+    $$PWD/src/tfcompute.h \
+    $$PWD/src/tfworker.h \
+    $$PWD/src/coloroccupancy.h \
+    $$PWD/src/annotations.h \
+    $$PWD/src/cpuraycaster.h \
+
+INCLUDEPATH += \
+    $$PWD/src
+
+RESOURCES += \
+    $$PWD/resources.qrc
+
+# OpenMP in every build, so that debug builds run the bakers on all cores too
+gcc:QMAKE_CXXFLAGS += -std=c++17 -fopenmp
+gcc:QMAKE_CXXFLAGS_RELEASE += -Ofast
+gcc:LIBS += -fopenmp -L/usr/local/lib -lopenslide -lGL -lGLU
+
+msvc:QMAKE_CXXFLAGS += /openmp
+msvc:QMAKE_CXXFLAGS_RELEASE += /O2
@@ -41,9 +41,52 @@ uniform float step_length;
 uniform float threshold;
 
 uniform sampler3D volume;
+uniform vec3 volume_offset;
+uniform vec3 volume_scale;
+uniform vec3 volume_texture_size;
+uniform float volume_max_lod;
 uniform sampler3D color_proximity_tf;
-uniform sampler3D space_proximity_tf;
-uniform sampler1D segment_opacity_tf;
+
+// Opacity of each voxel with every TF applied, laid out like the volume,
+// sampled instead of evaluating the TFs when pre-classified
+uniform bool preclassified;
+uniform sampler3D opacity_volume;
+
+// Opacity of each segment, indexed by material id
+const int MAX_NUM_SEGMENTS = 3;
+uniform float segment_opacities[MAX_NUM_SEGMENTS];
+
+// Segment TF integrated over ray segments along which the material id varies
+// linearly, indexed by the ids at both ends. Its opacities, like those of
+// every TF, are for the reference step length, and are corrected by
+// opacity_correction, the ratio of step_length to it.
+uniform bool preintegrated;
+uniform sampler2D preintegrated_tf;
+uniform float opacity_correction;
+
+// Slicing planes: normal and offset of each plane, hiding the points p
+// where dot(normal, p) <= offset, and its opacity
+const int MAX_SLICING_PLANES = 16;
+uniform int slicing_plane_count;
+uniform vec4 slicing_planes[MAX_SLICING_PLANES];
+uniform float slicing_plane_opacities[MAX_SLICING_PLANES];
+
+// Polygons, as a 2D mask with one layer per depth range
+const int MAX_POLYGON_MASK_LAYERS = 8;
+uniform sampler2DArray polygon_mask;
+uniform int polygon_mask_layers;
+uniform vec2 polygon_mask_depths[MAX_POLYGON_MASK_LAYERS];
+
+// TFs that have nothing to apply are skipped instead of sampled
+uniform bool color_tf_enabled;
+
+// A few colour picks are evaluated directly instead of baked into
+// color_proximity_tf: centre (0-255) and squared radius, and opacity
+const int MAX_ANALYTIC_COLOR_TFS = 16;
+uniform int color_tf_count;
+uniform vec4 color_tf_spheres[MAX_ANALYTIC_COLOR_TFS];
+uniform float color_tf_opacities[MAX_ANALYTIC_COLOR_TFS];
+uniform float volume_opacity;
 
 uniform float light_position_x;
 uniform float light_position_y;
@@ -52,7 +95,6 @@ uniform float light_position_z;
 
 uniform float gamma;
 uniform bool lighting_enabled;
-float MAX_NUM_SEGMENTS = 3.0;
 
 // Ray
 struct Ray {
@@ -66,13 +108,134 @@ struct AABB {
     vec3 bottom;
 };
 
+// Mip level of the volume to sample along the current ray
+float volume_lod = 0.0;
+
+// Sample the volume. Its texture is a ring buffer that wraps around in x and y,
+// with the visible region starting at volume_offset. Texels are stored as
+// straight RGBA, with the material id in alpha.
+vec4 sample_volume(vec3 position)
+{
+    return textureLod(volume, position * volume_scale + volume_offset, volume_lod);
+}
+
+// Sample the pre-classified opacity of the volume
+float sample_opacity(vec3 position)
+{
+    return textureLod(opacity_volume, position * volume_scale + volume_offset, 0.0).r;
+}
+
+// Level of detail matching the pixel footprint at the ray entry point, in
+// texels. Samples further apart than a texel raise it to their spacing, so
+// that steps do not skip texels. Slices are all alike, so only distances
+// across the slide count.
+float ray_lod(vec3 ray_start, vec3 step_vector)
+{
+    vec2 texels = volume_scale.xy * volume_texture_size.xy;
+    float footprint = max(length(dFdx(ray_start).xy * texels), length(dFdy(ray_start).xy * texels));
+    float spacing = length(step_vector.xy * texels);
+    float lod = log2(footprint);
+    if (spacing > 1.0)
+        lod = max(lod, log2(spacing));
+    return clamp(lod, 0.0, volume_max_lod);
+}
+
+// Opacity given by the colour TF
+float color_tf(vec3 colour)
+{
+    if (color_tf_count > 0)
+    {
+        float opacity = 1.0;
+        for (int i = 0; i < color_tf_count; i++)
+        {
+            vec3 d = colour * 255.0 - color_tf_spheres[i].xyz;
+            if (dot(d, d) <= color_tf_spheres[i].w + 0.5)
+                opacity *= color_tf_opacities[i];
+        }
+        return opacity;
+    }
+    return color_tf_enabled ? texture(color_proximity_tf, colour).r : 1.0;
+}
+
+// Opacity given by the segment TF, for the material id in the volume alpha.
+// Interpolated between neighbouring segments like a linearly filtered
+// texture with one texel per segment would be.
+float segment_tf(float material)
+{
+    float seg_id = (256.0 - material * 256.0) / float(MAX_NUM_SEGMENTS);
+    float u = seg_id * float(MAX_NUM_SEGMENTS) - 0.5;
+    int i = int(floor(u));
+    float a = segment_opacities[clamp(i, 0, MAX_NUM_SEGMENTS - 1)];
+    float b = segment_opacities[clamp(i + 1, 0, MAX_NUM_SEGMENTS - 1)];
+    return mix(a, b, u - floor(u));
+}
+
+// Opacity given by the segment TF to the ray segment from the previous sample,
+// with material id material_front, to this one
+float segment_tf_integrated(float material_front, float material)
+{
+    return texture(preintegrated_tf, (vec2(material_front, material) * 255.0 + 0.5) / 256.0).r;
+}
+
+// Opacity of a step of step_length, given the opacity of a step of the
+// reference length
+float correct_opacity(float opacity)
+{
+    return 1.0 - pow(1.0 - opacity, opacity_correction);
+}
+
+// Opacity given by polygons and slicing planes: the product of the opacities
+// of those covering the position, or the volume opacity if none does. Mask
+// texels hold that product for the polygons of a layer, and whether any
+// polygon covers them.
+float location_tf(vec3 position)
+{
+    float opacity = 1.0;
+    bool covered = false;
+    for (int i = 0; i < polygon_mask_layers; i++)
+    {
+        if (position.z >= polygon_mask_depths[i].x && position.z <= polygon_mask_depths[i].y)
+        {
+            vec2 mask = texture(polygon_mask, vec3(position.xy, float(i))).rg;
+            if (mask.g > 0.5)
+            {
+                opacity *= mask.r;
+                covered = true;
+            }
+        }
+    }
+    for (int i = 0; i < slicing_plane_count; i++)
+    {
+        if (dot(slicing_planes[i].xyz, position) <= slicing_planes[i].w)
+        {
+            opacity *= slicing_plane_opacities[i];
+            covered = true;
+        }
+    }
+    return covered ? opacity : volume_opacity;
+}
+
+// Opacity of a sample: the product of the segment, colour and location TFs.
+// Cheaper TFs go first, and texture fetches are skipped once the sample is
+// known to be transparent. When pre-integrated, the segment TF covers the
+// ray segment from the previous sample, with material id material_front.
+float tf_opacity(vec4 voxel, vec3 position, float material_front)
+{
+    float opacity = preintegrated ? segment_tf_integrated(material_front, voxel.a) : segment_tf(voxel.a);
+    if (opacity > 0.0)
+        opacity *= color_tf(voxel.rgb);
+    if (opacity > 0.0)
+        opacity *= location_tf(position);
+    return opacity;
+}
+
 // Estimate normal from a finite difference approximation of the gradient
 vec3 normal(vec3 position, float position_material)
 {
     float d  = step_length / 10.0;
-    float dx = texture(volume, position + vec3(d,0,0)).gbar.a - position_material;
-    float dy = texture(volume, position + vec3(0,d,0)).gbar.a - position_material;
-    float dz = texture(volume, position + vec3(0,0,d)).gbar.a - position_material;
+    float dx = sample_volume(position + vec3(d,0,0)).a - position_material;
+    float dy = sample_volume(position + vec3(0,d,0)).a - position_material;
+    float dz = sample_volume(position + vec3(0,0,d)).a - position_material;
     return -normalize(NormalMatrix * vec3(dx, dy, dz));
 }
 
@@ -90,12 +253,33 @@ void ray_box_intersection(Ray ray, AABB box, out float t_0, out float t_1)
     t_1 = min(t.x, t.y);
 }
 
-// Blinn-Phong shading model to compute colors
-vec3 blinn_phong(vec3 position, vec3 ray)
+// Restrict a ray to the parts not hidden by fully transparent slicing planes,
+// given the ray in volume coordinates as position + t * direction
+void clip_ray_to_planes(vec3 position, vec3 direction, inout float t_0, inout float t_1)
+{
+    for (int i = 0; i < slicing_plane_count; i++)
+    {
+        if (slicing_plane_opacities[i] > 0.0)
+            continue;
+
+        // visible where dot(normal, position + t * direction) > offset
+        float d = dot(slicing_planes[i].xyz, direction);
+        float f = slicing_planes[i].w - dot(slicing_planes[i].xyz, position);
+        if (d > 0.0)
+            t_0 = max(t_0, f / d);
+        else if (d < 0.0)
+            t_1 = min(t_1, f / d);
+        else if (f >= 0.0)
+            t_1 = t_0;
+    }
+}
+
+// Blinn-Phong shading model to compute colors, given the volume sample at
+// the position
+vec3 blinn_phong(vec3 position, vec4 position_intensity, vec3 ray)
 {
     vec3 colour;
 
-    vec4 position_intensity = texture(volume, position).gbar;
     vec3 position_color = position_intensity.rgb;
     float position_material = position_intensity.a;
     
@@ -152,17 +336,16 @@ vec3 blinn_phong(vec3 position, vec3 ray)
     return colour;
 }
 
-// Secant method to find the point of intersection between different material boundaries
-vec3 secant_method(vec3 position, vec3 position_next, float p_iso)
+// Secant method to find the point of intersection between different material boundaries,
+// given the volume samples at both ends; the sample at the intersection is returned in intensity_new
+vec3 secant_method(vec3 position, vec3 position_next, vec4 intensity, vec4 intensity_next, float p_iso, out vec4 intensity_new)
 {
     vec3 position_new;
 
     for(int i = 0; i < 4; i++)
     {
-        vec4 intensity = texture(volume, position).gbar;
-        vec4 intensity_next = texture(volume, position_next).gbar;
         position_new = ((position_next - position) * (p_iso - intensity.a))/(intensity_next.a - intensity.a) + position;
-        vec4 intensity_new = texture(volume, position_new).gbar;
+        intensity_new = sample_volume(position_new);
 
         if(intensity_new.a == p_iso)
         {
@@ -172,11 +355,13 @@ vec3 secant_method(vec3 position, vec3 position_next, float p_iso)
         else if(intensity_new.a > p_iso)
         {
             position = position_new;
+            intensity = intensity_new;
         }
 
         else
         {
             position_next = position_new;
+            intensity_next = intensity_new;
         }
 
     }
@@ -197,6 +382,7 @@ void main()
     Ray casting_ray = Ray(ray_origin, ray_direction);
     AABB bounding_box = AABB(top, bottom);
     ray_box_intersection(casting_ray, bounding_box, t_0, t_1);
+    clip_ray_to_planes((ray_origin - bottom) / (top - bottom), ray_direction / (top - bottom), t_0, t_1);
 
     vec3 ray_start = (ray_origin + ray_direction * t_0 - bottom) / (top - bottom);
     vec3 ray_stop = (ray_origin + ray_direction * t_1 - bottom) / (top - bottom);
@@ -205,6 +391,12 @@ void main()
     float ray_length = length(ray);
     vec3 step_vector = step_length * ray / ray_length;
 
+    volume_lod = ray_lod(ray_start, step_vector);
+
+    // nothing left after clipping
+    if (t_1 <= t_0)
+        ray_length = 0.0;
+
     ray_start += step_vector;
 
     vec3 position = ray_start;
@@ -215,21 +407,31 @@ void main()
     float intersect = 0.0; 
     vec4 colour_intersection = vec4(0.0);
 
-    // Ray march until reaching the end of the volume, or colour saturation
-    while (ray_length > 0 && colour.a < 1.0) {
+    // sample at the next position, when lighting has already fetched it
+    vec4 intensity_next = vec4(0.0);
+    bool sampled_next = false;
 
-        vec4 c = texture(volume, position).gbar;
-        float position_material = c.a;
+    // material id of the previous sample, negative before the first one
+    float material_front = -1.0;
 
-        float seg_id = (256 - c.a * 256)/MAX_NUM_SEGMENTS;
+    // Ray march until reaching the end of the volume, or colour saturation
+    while (ray_length > 0 && colour.a < 1.0) {
 
-        // so that TF doesn't get affected by segment values
-        c.a = 1.0;
-        
-        float a1 = texture(color_proximity_tf, c.rgb).r;
-        float a2 = texture(space_proximity_tf, position).r;
-        float a3 = texture(segment_opacity_tf, seg_id).r;
-        c.a = a1*a2*a3;
+        // when pre-classified, the volume is only fetched where the opacity
+        // is not zero; a transparent sample leaves its colour unused
+        vec4 intensity = vec4(0.0);
+        vec4 c = vec4(0.0);
+        float opacity = preclassified ? sample_opacity(position) : 1.0;
+        if (opacity > 0.0)
+        {
+            intensity = sampled_next ? intensity_next : sample_volume(position);
+            c = intensity;
+            c.a = preclassified ? opacity : tf_opacity(intensity, position, material_front < 0.0 ? intensity.a : material_front);
+            if (preintegrated)
+                c.a = correct_opacity(c.a);
+        }
+        material_front = opacity > 0.0 ? intensity.a : -1.0;
+        sampled_next = false;
 
 
         if (lighting_enabled && c.a > 0.0)
@@ -237,18 +439,19 @@ void main()
             if((ray_length - step_length) >= 0)
             {
                 vec3 position_next = position + step_vector;
-                vec4 intensity = texture(volume, position).gbar;
-                vec4 intensity_next = texture(volume, position_next).gbar;
+                intensity_next = sample_volume(position_next);
+                sampled_next = true;
 
                 if(intensity.a != intensity_next.a)
                 {
                     float p_iso = (intensity.a + intensity_next.a) / 2.0;
-                    vec3 material_intersection = secant_method(position, position_next, p_iso);
+                    vec4 intensity_intersection;
+                    vec3 material_intersection = secant_method(position, position_next, intensity, intensity_next, p_iso, intensity_intersection);
 
                     // Check to see if blinn-phong lighting at boundaries produces any changes
                     // colour_intersection.xyz = intensity.rgb;
                     
-                    colour_intersection.xyz = blinn_phong(material_intersection, ray);
+                    colour_intersection.xyz = blinn_phong(material_intersection, intensity_intersection, ray);
                     colour_intersection.w = 1.0;
                     intersect = 1.0;
 
@@ -257,11 +460,11 @@ void main()
             }
 
             // Check to see if blinn-phong produces any changes
-            // c.rgb = texture(volume, position).gbar.rgb;
+            // c.rgb = sample_volume(position).rgb;
             
             // c.rgb = blinn_phong(position, ray);            
             
-            c.rgb = blinn_phong(position, ray);            
+            c.rgb = blinn_phong(position, intensity, ray);            
             
 
             // Alpha-blending
@@ -269,8 +472,12 @@ void main()
             // colour.a = c.a + (1 - c.a) * colour.a;
 
         }
-        // Alpha-blending
-        colour.rgb = c.a * c.rgb + (1 - c.a) * colour.a * colour.rgb;
+        // Alpha-blending; pre-integrated samples blend with the colour kept
+        // premultiplied, so that the result does not depend on the step length
+        if (preintegrated)
+            colour.rgb = c.a * c.rgb + (1 - c.a) * colour.rgb;
+        else
+            colour.rgb = c.a * c.rgb + (1 - c.a) * colour.a * colour.rgb;
         colour.a = c.a + (1 - c.a) * colour.a;
 
         if(lighting_enabled && intersect == 1.0 && c.a > 0.0)
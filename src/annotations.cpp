@@ -0,0 +1,177 @@
+#include "annotations.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QXmlStreamReader>
+
+// append a ring, closing it if the file does not. Rings after the first are
+// followed by a step back to the first vertex, so that the edge to each ring
+// and the one back from it overlap and cancel under the even-odd rule; a
+// chain through three rings or more would enclose area between them.
+static void append_ring(std::vector<QPointF>& vertices, const std::vector<QPointF>& ring)
+{
+    if (ring.size() < 3)
+        return;
+    const bool first = vertices.empty();
+    vertices.insert(vertices.end(), ring.begin(), ring.end());
+    if (ring.front() != ring.back())
+        vertices.push_back(ring.front());
+    if (!first)
+        vertices.push_back(vertices.front());
+}
+
+// rings of a GeoJSON Polygon, MultiPolygon or GeometryCollection; other
+// geometries (points, lines) enclose nothing and are skipped
+static void read_geometry(const QJsonObject& geometry, std::vector<QPointF>& vertices)
+{
+    const QString type = geometry["type"].toString();
+    if (type == "GeometryCollection")
+    {
+        for (const QJsonValue& g : geometry["geometries"].toArray())
+            read_geometry(g.toObject(), vertices);
+        return;
+    }
+
+    QJsonArray polygons;
+    if (type == "Polygon")
+        polygons.append(geometry["coordinates"]);
+    else if (type == "MultiPolygon")
+        polygons = geometry["coordinates"].toArray();
+
+    for (const QJsonValue& polygon : polygons)
+    {
+        for (const QJsonValue& r : polygon.toArray())
+        {
+            std::vector<QPointF> ring;
+            for (const QJsonValue& p : r.toArray())
+            {
+                const QJsonArray xy = p.toArray();
+                ring.push_back(QPointF(xy[0].toDouble(), xy[1].toDouble()));
+            }
+            append_ring(vertices, ring);
+        }
+    }
+}
+
+static void read_feature(const QJsonObject& feature, std::vector<Annotation>& annotations)
+{
+    Annotation a;
+    if (feature["type"].toString() == "Feature")
+    {
+        const QJsonObject properties = feature["properties"].toObject();
+        a.name = properties["name"].toString();
+        a.group = properties["classification"].toObject()["name"].toString();
+        read_geometry(feature["geometry"].toObject(), a.vertices);
+    }
+    else
+    {
+        read_geometry(feature, a.vertices);
+    }
+    if (!a.vertices.empty())
+        annotations.push_back(std::move(a));
+}
+
+// GeoJSON as exported by QuPath: a FeatureCollection, an array of features,
+// a single feature or a bare geometry
+static std::vector<Annotation> load_geojson(QFile& file)
+{
+    QJsonParseError error;
+    const QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &error);
+    if (document.isNull())
+        throw std::runtime_error("Invalid GeoJSON: " + error.errorString().toStdString());
+
+    std::vector<Annotation> annotations;
+    if (document.isArray())
+    {
+        for (const QJsonValue& feature : document.array())
+            read_feature(feature.toObject(), annotations);
+    }
+    else if (document.object()["type"].toString() == "FeatureCollection")
+    {
+        for (const QJsonValue& feature : document.object()["features"].toArray())
+            read_feature(feature.toObject(), annotations);
+    }
+    else
+    {
+        read_feature(document.object(), annotations);
+    }
+    return annotations;
+}
+
+// ASAP XML: <Annotation Name Type PartOfGroup> elements holding
+// <Coordinate Order X Y> elements
+static std::vector<Annotation> load_asap(QFile& file)
+{
+    std::vector<Annotation> annotations;
+    QXmlStreamReader xml(&file);
+    Annotation a;
+    QString type;
+    std::vector<std::pair<int, QPointF>> coordinates;
+
+    // some locales write decimal commas
+    auto number = [](const auto& s) { return s.toString().replace(',', '.').toDouble(); };
+
+    while (!xml.atEnd())
+    {
+        xml.readNext();
+        if (xml.isStartElement() && xml.name() == QLatin1String("Annotation"))
+        {
+            a = Annotation();
+            a.name = xml.attributes().value("Name").toString();
+            a.group = xml.attributes().value("PartOfGroup").toString();
+            type = xml.attributes().value("Type").toString();
+            coordinates.clear();
+        }
+        else if (xml.isStartElement() && xml.name() == QLatin1String("Coordinate"))
+        {
+            const QXmlStreamAttributes attributes = xml.attributes();
+            coordinates.push_back({attributes.value("Order").toInt(),
+                                   QPointF(number(attributes.value("X")), number(attributes.value("Y")))});
+        }
+        else if (xml.isEndElement() && xml.name() == QLatin1String("Annotation"))
+        {
+            // dots and point sets enclose nothing
+            if (type != "Polygon" && type != "Spline" && type != "Rectangle")
+                continue;
+            std::stable_sort(coordinates.begin(), coordinates.end(),
+                             [](const auto& a, const auto& b) { return a.first < b.first; });
+            std::vector<QPointF> ring;
+            for (const auto& c : coordinates)
+                ring.push_back(c.second);
+            append_ring(a.vertices, ring);
+            if (!a.vertices.empty())
+                annotations.push_back(std::move(a));
+        }
+    }
+    if (xml.hasError())
+        throw std::runtime_error("Invalid ASAP XML: " + xml.errorString().toStdString());
+    return annotations;
+}
+
+/*!
+ * \brief Read the polygon annotations of a slide.
+ * \param filename GeoJSON (.geojson, .json) export from QuPath, or XML
+ * (.xml) export from ASAP.
+ * \return The annotations enclosing an area, in file order.
+ *
+ * Throws std::runtime_error if the file cannot be read or parsed.
+ */
+std::vector<Annotation> load_annotations(const QString& filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+        throw std::runtime_error("Cannot open " + filename.toStdString() + ".");
+
+    const QString extension = QFileInfo(filename).suffix().toLower();
+    if (extension == "geojson" || extension == "json")
+        return load_geojson(file);
+    if (extension == "xml")
+        return load_asap(file);
+    throw std::runtime_error("Unrecognised extension '" + extension.toStdString() + "'.");
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <vector>
+
+#include <QPointF>
+#include <QString>
+
+/*!
+ * \brief An annotation read from a QuPath or ASAP export.
+ *
+ * The outline is in pixels of the slide's full resolution level. Polygons
+ * with holes, and multi-polygons, are stored as their rings, each closed,
+ * joined through the first vertex: every ring after the first is followed by
+ * a return to it. Polygon fills the outline with the even-odd rule.
+ */
+struct Annotation {
+    QString name;
+    QString group;                  // QuPath classification or ASAP group, may be empty
+    std::vector<QPointF> vertices;
+};
+
+std::vector<Annotation> load_annotations(const QString& filename);
@@ -0,0 +1,76 @@
+#include "coloroccupancy.h"
+
+#include <algorithm>
+
+ColorOccupancy::ColorOccupancy()
+    : m_counts(COLOR_BRICKS * COLOR_BRICKS * COLOR_BRICKS, 0)
+{
+}
+
+/*!
+ * \brief Forget every colour, e.g. when a new region replaces the old one.
+ */
+void ColorOccupancy::clear()
+{
+    std::fill(m_counts.begin(), m_counts.end(), 0);
+    m_version++;
+}
+
+/*!
+ * \brief Count the colours of a block of texels.
+ * \param pixels Straight RGBA bytes in memory order, alpha is ignored.
+ * \param n Number of texels.
+ *
+ * Each thread fills a histogram of its own, merged at the end.
+ */
+void ColorOccupancy::add(const uint32_t *pixels, size_t n)
+{
+    const int64_t count = n;
+    #pragma omp parallel
+    {
+        std::vector<uint32_t> counts(m_counts.size(), 0);
+        #pragma omp for schedule(static)
+        for (int64_t i = 0; i < count; i++) {
+            const uint32_t p = pixels[i];
+            const int r = (p & 0xff) / COLOR_BRICK;
+            const int g = ((p >> 8) & 0xff) / COLOR_BRICK;
+            const int b = ((p >> 16) & 0xff) / COLOR_BRICK;
+            counts[(b * COLOR_BRICKS + g) * COLOR_BRICKS + r]++;
+        }
+        #pragma omp critical
+        for (size_t i = 0; i < counts.size(); i++) {
+            m_counts[i] += counts[i];
+        }
+    }
+    m_version++;
+}
+
+/*!
+ * \brief Bricks the volume may sample, as one flag per brick indexed
+ * [blue][green][red].
+ *
+ * Filtering blends neighbouring texels, and the TF is sampled between its
+ * cells, so the bricks holding colours are dilated by one brick.
+ */
+std::vector<uint8_t> ColorOccupancy::occupied_bricks() const
+{
+    const int n = COLOR_BRICKS;
+    std::vector<uint8_t> bricks(m_counts.size(), 0);
+    for (int b = 0; b < n; b++) {
+        for (int g = 0; g < n; g++) {
+            for (int r = 0; r < n; r++) {
+                if (m_counts[(b * n + g) * n + r] == 0) {
+                    continue;
+                }
+                for (int z = std::max(0, b - 1); z <= std::min(n - 1, b + 1); z++) {
+                    for (int y = std::max(0, g - 1); y <= std::min(n - 1, g + 1); y++) {
+                        for (int x = std::max(0, r - 1); x <= std::min(n - 1, r + 1); x++) {
+                            bricks[(z * n + y) * n + x] = 1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return bricks;
+}
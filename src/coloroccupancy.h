@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*!
+ * \brief Sparse index of the colours present in a region of the slide.
+ *
+ * The RGB cube is split into bricks of COLOR_BRICK^3 colour values, and the
+ * index counts the texels falling into each. A slide only uses a small part
+ * of the cube, so TF bakes can skip the bricks no texel can sample.
+ */
+class ColorOccupancy
+{
+public:
+    static const int COLOR_BRICK = 8;                   /*!< Colour values per brick side. */
+    static const int COLOR_BRICKS = 256 / COLOR_BRICK;  /*!< Bricks per axis of the RGB cube. */
+
+    ColorOccupancy();
+
+    void clear();
+    void add(const uint32_t *pixels, size_t n);
+
+    /*!
+     * \brief Counter incremented whenever the index changes.
+     */
+    unsigned int version() const { return m_version; }
+
+    std::vector<uint8_t> occupied_bricks() const;
+
+private:
+    std::vector<uint32_t> m_counts;     /*!< Texels per brick, indexed [blue][green][red]. */
+    unsigned int m_version {0};
+};
@@ -0,0 +1,642 @@
+#include "cpuraycaster.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const int TILE = 32;        // tile side in pixels, a multiple of the 2x2 quads
+const float NEAR = 0.1f;    // clipping planes of the canvas projection
+const float FAR = 100.0f;
+
+// halve a ring slice, averaging 2x2 texels; ring sizes are multiples of
+// the texture's mip alignment, so texels do not straddle the wrap
+std::vector<uint32_t> reduce(const std::vector<uint32_t>& src, int width, int height)
+{
+    const int w = std::max(width / 2, 1);
+    const int h = std::max(height / 2, 1);
+    std::vector<uint32_t> dst((size_t) w * h);
+    #pragma omp parallel for
+    for (int j = 0; j < h; j++) {
+        const int j0 = std::min(2 * j, height - 1), j1 = std::min(2 * j + 1, height - 1);
+        for (int i = 0; i < w; i++) {
+            const int i0 = std::min(2 * i, width - 1), i1 = std::min(2 * i + 1, width - 1);
+            const uint32_t p[4] = {src[(size_t) j0 * width + i0], src[(size_t) j0 * width + i1],
+                                   src[(size_t) j1 * width + i0], src[(size_t) j1 * width + i1]};
+            uint32_t texel = 0;
+            for (int c = 0; c < 32; c += 8) {
+                const uint32_t sum = ((p[0] >> c) & 0xff) + ((p[1] >> c) & 0xff)
+                                   + ((p[2] >> c) & 0xff) + ((p[3] >> c) & 0xff);
+                texel |= ((sum + 2) / 4) << c;
+            }
+            dst[(size_t) j * w + i] = texel;
+        }
+    }
+    return dst;
+}
+
+inline float lerp(float a, float b, float t)
+{
+    // exact where both ends are equal, as the material id comparisons need
+    return a + (b - a) * t;
+}
+
+inline QVector4D unpack(uint32_t texel)
+{
+    return QVector4D(texel & 0xff, (texel >> 8) & 0xff, (texel >> 16) & 0xff, texel >> 24) / 255.0f;
+}
+
+inline int wrap(int i, int n)
+{
+    return ((i % n) + n) % n;
+}
+
+// 1 / x, finite for axis parallel rays
+inline float inverse(float x)
+{
+    const float tiny = 1e-20f;
+    return 1.0f / (std::fabs(x) < tiny ? std::copysign(tiny, x) : x);
+}
+
+inline QVector3D normalize(const QVector3D& v)
+{
+    // zero where the shader's normalize() would give NaN, which max(0, .)
+    // and the lighting terms then turn into 0 on common GPUs
+    const float length = v.length();
+    return length > 0.0f ? v / length : QVector3D(0.0f, 0.0f, 0.0f);
+}
+
+} // namespace
+
+
+/*!
+ * \brief Difference between two images.
+ * \param a Input, RGBA bytes.
+ * \param b Input, RGBA bytes.
+ * \param pixels Pixels in each image.
+ * \param tolerance Largest difference per channel to accept.
+ */
+ImageDifference compare_images(const uint8_t *a, const uint8_t *b, int64_t pixels, int tolerance)
+{
+    ImageDifference difference;
+    int64_t total = 0;
+    for (int64_t i = 0; i < 4 * pixels; i++) {
+        const int d = std::abs(a[i] - b[i]);
+        difference.max = std::max(difference.max, d);
+        difference.exceeding += d > tolerance;
+        total += d;
+    }
+    difference.mean = pixels ? (double) total / (4 * pixels) : 0.0;
+    return difference;
+}
+
+
+/*!
+ * \brief Prepare the volume mip levels and the polygon mask.
+ *
+ * Throws std::runtime_error if \p volume holds no ring slice, e.g. when it
+ * was copied from a RayCastVolume before any volume was loaded.
+ */
+CPURayCaster::CPURayCaster(CPURayCastVolume volume)
+    : m_volume {std::move(volume)}
+{
+    const RingLayout& ring = m_volume.layout;
+    if (!m_volume.pixels || m_volume.pixels->size() < (size_t) ring.texture_width * ring.texture_height) {
+        throw std::runtime_error("No volume to render.");
+    }
+    m_offset = QVector3D(ring.x / (float) ring.texture_width, ring.y / (float) ring.texture_height, 0.0f);
+    m_scale = QVector3D(ring.width / (float) ring.texture_width, ring.height / (float) ring.texture_height, 1.0f);
+    m_texels = m_scale * QVector3D(ring.texture_width, ring.texture_height, ring.depth);
+
+    m_mips.push_back(*m_volume.pixels);
+    for (int l = 1; l < m_volume.levels; l++) {
+        m_mips.push_back(reduce(m_mips.back(), std::max(ring.texture_width >> (l - 1), 1),
+                                std::max(ring.texture_height >> (l - 1), 1)));
+    }
+
+    VolumeClassifier& tfs = m_volume.location_tfs;
+    const int layers = tfs.layer_depths.size();
+    m_polygon_mask.resize((size_t) 2 * tfs.mask_width * tfs.mask_height * layers);
+    if (!tfs.polygons.empty()) {
+        bake_polygon_mask(tfs.polygons, tfs.polygon_layers, tfs.mask_width, tfs.mask_height,
+                          m_polygon_mask.data(), TFBox {0, 0, 0, tfs.mask_width, tfs.mask_height, layers});
+    }
+}
+
+
+/*!
+ * \brief Render a frame.
+ * \param view Camera and shading parameters, as for RayCastVolume::raycast().
+ * \param dst Output, \p width x \p height RGBA bytes, top row first, as the
+ * framebuffer would hold them after a clear to the background.
+ */
+void CPURayCaster::render(const RayCastView& view, int width, int height, uint8_t *dst) const
+{
+    const QColor& bg = view.background;
+    const uint8_t background[4] = {(uint8_t) bg.red(), (uint8_t) bg.green(), (uint8_t) bg.blue(), (uint8_t) bg.alpha()};
+
+    const int tiles_x = (width + TILE - 1) / TILE;
+    const int tiles_y = (height + TILE - 1) / TILE;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int tile = 0; tile < tiles_x * tiles_y; tile++) {
+        const int x0 = (tile % tiles_x) * TILE;
+        const int y0 = (tile / tiles_x) * TILE;
+        // quads are aligned to even window coordinates, as on the GPU; y
+        // counts from the bottom, as gl_FragCoord does
+        for (int y = y0; y < std::min(y0 + TILE, height); y += 2) {
+            for (int x = x0; x < std::min(x0 + TILE, width); x += 2) {
+                float colours[4][4];
+                bool covered[4];
+                render_quad(view, x, y, colours, covered);
+                for (int l = 0; l < 4; l++) {
+                    const int px = x + (l & 1);
+                    const int py = y + (l >> 1);
+                    if (px >= width || py >= height) {
+                        continue;
+                    }
+                    uint8_t *pixel = &dst[4 * ((size_t) (height - 1 - py) * width + px)];
+                    for (int c = 0; c < 4; c++) {
+                        pixel[c] = covered[l] ? (uint8_t) std::lrint(std::clamp(colours[l][c], 0.0f, 1.0f) * 255.0f)
+                                              : background[c];
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+/*!
+ * \brief March the rays of the 2x2 pixel quad with its lower left corner at
+ * (\p x, \p y), in lockstep.
+ * \param dst Output, gamma corrected RGBA colour of each ray.
+ * \param covered Output, whether the bounding box covers each pixel; the
+ * GPU only runs the shader there.
+ *
+ * Lanes are ordered (x, y), (x + 1, y), (x, y + 1), (x + 1, y + 1).
+ */
+void CPURayCaster::render_quad(const RayCastView& view, int x, int y, float dst[4][4], bool covered[4]) const
+{
+    const float *V = view.view_matrix.constData();
+    const QVector3D top = m_volume.top;
+    const QVector3D bottom = m_volume.bottom;
+    const QVector3D size = top - bottom;
+    const std::vector<QVector4D>& planes = m_volume.location_tfs.planes;
+    const std::vector<float>& plane_opacities = m_volume.location_tfs.plane_opacities;
+
+    QVector3D ray_start[4], step_vector[4], ray[4];
+    float ray_length[4];
+
+    for (int l = 0; l < 4; l++) {
+        // pixel centre to a ray in model space; v * ViewMatrix in the shader,
+        // which undoes the view rotation
+        const float fx = 2.0f * (x + (l & 1) + 0.5f) / view.viewport_size.x() - 1.0f;
+        const float fy = 2.0f * (y + (l >> 1) + 0.5f) / view.viewport_size.y() - 1.0f;
+        const QVector3D d(fx * view.aspect_ratio, fy, -view.focal_length);
+        const QVector3D direction(d.x() * V[0] + d.y() * V[1] + d.z() * V[2],
+                                  d.x() * V[4] + d.y() * V[5] + d.z() * V[6],
+                                  d.x() * V[8] + d.y() * V[9] + d.z() * V[10]);
+        const QVector3D origin = view.ray_origin;
+
+        // slab method
+        const QVector3D direction_inv(inverse(direction.x()), inverse(direction.y()), inverse(direction.z()));
+        const QVector3D t_top = direction_inv * (top - origin);
+        const QVector3D t_bottom = direction_inv * (bottom - origin);
+        const float t_in = std::max({std::min(t_top.x(), t_bottom.x()), std::min(t_top.y(), t_bottom.y()),
+                                     std::min(t_top.z(), t_bottom.z())});
+        float t_1 = std::min({std::max(t_top.x(), t_bottom.x()), std::max(t_top.y(), t_bottom.y()),
+                              std::max(t_top.z(), t_bottom.z())});
+        float t_0 = std::max(0.0f, t_in);
+
+        // the cube's front faces reach the pixel, between the clipping planes
+        const float depth = t_in * view.focal_length;
+        covered[l] = t_in < t_1 && depth >= NEAR && depth <= FAR;
+
+        // fully transparent slicing planes shorten the ray
+        const QVector3D position = (origin - bottom) / size;
+        const QVector3D dir = direction / size;
+        for (size_t i = 0; i < planes.size(); i++) {
+            if (plane_opacities[i] > 0.0f) {
+                continue;
+            }
+            const QVector3D normal = planes[i].toVector3D();
+            const float dn = QVector3D::dotProduct(normal, dir);
+            const float f = planes[i].w() - QVector3D::dotProduct(normal, position);
+            if (dn > 0.0f) {
+                t_0 = std::max(t_0, f / dn);
+            } else if (dn < 0.0f) {
+                t_1 = std::min(t_1, f / dn);
+            } else if (f >= 0.0f) {
+                t_1 = t_0;
+            }
+        }
+
+        ray_start[l] = (origin + direction * t_0 - bottom) / size;
+        const QVector3D ray_stop = (origin + direction * t_1 - bottom) / size;
+        ray[l] = ray_stop - ray_start[l];
+        ray_length[l] = ray[l].length();
+        step_vector[l] = ray_length[l] > 0.0f ? view.step_length * ray[l] / ray_length[l] : QVector3D(0.0f, 0.0f, 0.0f);
+        if (t_1 <= t_0) {
+            ray_length[l] = 0.0f;
+        }
+    }
+
+    // level of detail from the pixel footprint across the slide, with the
+    // finite differences of the quad for dFdx() and dFdy(), raised to the
+    // spacing of samples further apart than a texel
+    float lod[4];
+    for (int l = 0; l < 4; l++) {
+        const int row = l & 2, column = l & 1;
+        const QVector3D dx = (ray_start[row + 1] - ray_start[row]) * m_texels;
+        const QVector3D dy = (ray_start[column + 2] - ray_start[column]) * m_texels;
+        const float footprint = std::max(std::hypot(dx.x(), dx.y()), std::hypot(dy.x(), dy.y()));
+        const QVector3D step = step_vector[l] * m_texels;
+        const float spacing = std::hypot(step.x(), step.y());
+        float level = footprint > 0.0f ? std::log2(footprint) : 0.0f;
+        if (spacing > 1.0f) {
+            level = std::max(level, std::log2(spacing));
+        }
+        lod[l] = std::clamp(level, 0.0f, (float) (m_volume.levels - 1));
+    }
+
+    const float opacity_correction = view.step_length / m_volume.reference_step_length;
+    const bool lighting = m_volume.lighting;
+    const bool preintegrated = m_volume.preintegrated;
+
+    // packet state, one lane per ray
+    alignas(16) float px[4], py[4], pz[4], sx[4], sy[4], sz[4], length[4];
+    alignas(16) float cr[4] = {}, cg[4] = {}, cb[4] = {}, ca[4] = {};
+    float material_front[4] = {-1.0f, -1.0f, -1.0f, -1.0f};
+    QVector4D intensity_next[4];
+    bool sampled_next[4] = {};
+    for (int l = 0; l < 4; l++) {
+        const QVector3D start = ray_start[l] + step_vector[l];
+        px[l] = start.x(); py[l] = start.y(); pz[l] = start.z();
+        sx[l] = step_vector[l].x(); sy[l] = step_vector[l].y(); sz[l] = step_vector[l].z();
+        length[l] = covered[l] ? ray_length[l] : 0.0f;
+    }
+
+    for (;;) {
+        alignas(16) float active[4];
+        bool any = false;
+        for (int l = 0; l < 4; l++) {
+            const bool a = length[l] > 0.0f && ca[l] < 1.0f;
+            active[l] = a ? 1.0f : 0.0f;
+            any |= a;
+        }
+        if (!any) {
+            break;
+        }
+
+        // sample, and apply the segment TF
+        alignas(16) float r[4] = {}, g[4] = {}, b[4] = {}, material[4] = {}, opacity[4] = {};
+        for (int l = 0; l < 4; l++) {
+            if (!active[l]) {
+                continue;
+            }
+            const QVector4D intensity = sampled_next[l] ? intensity_next[l] : sample_volume(QVector3D(px[l], py[l], pz[l]), lod[l]);
+            r[l] = intensity.x(); g[l] = intensity.y(); b[l] = intensity.z(); material[l] = intensity.w();
+            opacity[l] = preintegrated
+                    ? segment_tf_integrated(material_front[l] < 0.0f ? material[l] : material_front[l], material[l])
+                    : segment_tf(material[l]);
+        }
+
+        // colour TF, for the whole packet
+        const std::vector<QVector4D>& spheres = m_volume.color_tfs;
+        int l = 0;
+#ifdef __SSE2__
+        {
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 unit = _mm_set1_ps(255.0f);
+            const __m128 r255 = _mm_mul_ps(_mm_load_ps(r), unit);
+            const __m128 g255 = _mm_mul_ps(_mm_load_ps(g), unit);
+            const __m128 b255 = _mm_mul_ps(_mm_load_ps(b), unit);
+            __m128 o = _mm_load_ps(opacity);
+            for (size_t i = 0; i < spheres.size(); i++) {
+                const __m128 dr = _mm_sub_ps(r255, _mm_set1_ps(spheres[i].x()));
+                const __m128 dg = _mm_sub_ps(g255, _mm_set1_ps(spheres[i].y()));
+                const __m128 db = _mm_sub_ps(b255, _mm_set1_ps(spheres[i].z()));
+                const __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+                const __m128 inside = _mm_cmple_ps(d2, _mm_set1_ps(spheres[i].w() + 0.5f));
+                o = _mm_mul_ps(o, _mm_or_ps(_mm_and_ps(inside, _mm_set1_ps(m_volume.color_tf_opacities[i])),
+                                            _mm_andnot_ps(inside, one)));
+            }
+            _mm_store_ps(opacity, o);
+            l = 4;
+        }
+#endif
+        for (; l < 4; l++) {
+            for (size_t i = 0; i < spheres.size(); i++) {
+                const QVector3D d = QVector3D(r[l], g[l], b[l]) * 255.0f - spheres[i].toVector3D();
+                if (QVector3D::dotProduct(d, d) <= spheres[i].w() + 0.5f) {
+                    opacity[l] *= m_volume.color_tf_opacities[i];
+                }
+            }
+        }
+
+        // location TF and lighting, per ray
+        alignas(16) float c_r[4], c_g[4], c_b[4];
+        bool intersect[4] = {};
+        QVector3D colour_intersection[4];
+        for (l = 0; l < 4; l++) {
+            c_r[l] = r[l]; c_g[l] = g[l]; c_b[l] = b[l];
+            if (!active[l]) {
+                continue;
+            }
+            const QVector3D position(px[l], py[l], pz[l]);
+            if (opacity[l] > 0.0f) {
+                opacity[l] *= location_tf(position);
+            }
+            if (preintegrated) {
+                opacity[l] = 1.0f - std::pow(1.0f - opacity[l], opacity_correction);
+            }
+            material_front[l] = material[l];
+            sampled_next[l] = false;
+
+            if (lighting && opacity[l] > 0.0f) {
+                const QVector4D intensity(r[l], g[l], b[l], material[l]);
+                if (length[l] - view.step_length >= 0.0f) {
+                    const QVector3D position_next = position + step_vector[l];
+                    intensity_next[l] = sample_volume(position_next, lod[l]);
+                    sampled_next[l] = true;
+                    if (intensity.w() != intensity_next[l].w()) {
+                        const float p_iso = (intensity.w() + intensity_next[l].w()) / 2.0f;
+                        QVector4D intensity_intersection;
+                        const QVector3D material_intersection = secant_method(position, position_next, intensity, intensity_next[l],
+                                                                              p_iso, lod[l], intensity_intersection);
+                        colour_intersection[l] = blinn_phong(view, material_intersection, intensity_intersection, ray[l], lod[l]);
+                        intersect[l] = true;
+                    }
+                }
+                const QVector3D c = blinn_phong(view, position, intensity, ray[l], lod[l]);
+                c_r[l] = c.x(); c_g[l] = c.y(); c_b[l] = c.z();
+            }
+        }
+
+        // blend and advance the packet; finished rays keep their colour
+        l = 0;
+#ifdef __SSE2__
+        {
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 live = _mm_cmpgt_ps(_mm_load_ps(active), _mm_setzero_ps());
+            const __m128 a = _mm_and_ps(live, _mm_load_ps(opacity));
+            const __m128 keep = _mm_sub_ps(one, a);
+            const __m128 alpha = _mm_load_ps(ca);
+            // pre-integrated samples blend with the colour kept premultiplied
+            const __m128 below = preintegrated ? keep : _mm_mul_ps(keep, alpha);
+            const float *src[3] = {c_r, c_g, c_b};
+            float *colour[3] = {cr, cg, cb};
+            for (int c = 0; c < 3; c++) {
+                const __m128 old = _mm_load_ps(colour[c]);
+                const __m128 blended = _mm_add_ps(_mm_mul_ps(a, _mm_load_ps(src[c])), _mm_mul_ps(below, old));
+                _mm_store_ps(colour[c], _mm_or_ps(_mm_and_ps(live, blended), _mm_andnot_ps(live, old)));
+            }
+            _mm_store_ps(ca, _mm_add_ps(a, _mm_mul_ps(keep, alpha)));
+
+            const __m128 step = _mm_and_ps(live, _mm_set1_ps(view.step_length));
+            _mm_store_ps(length, _mm_sub_ps(_mm_load_ps(length), step));
+            _mm_store_ps(px, _mm_add_ps(_mm_load_ps(px), _mm_and_ps(live, _mm_load_ps(sx))));
+            _mm_store_ps(py, _mm_add_ps(_mm_load_ps(py), _mm_and_ps(live, _mm_load_ps(sy))));
+            _mm_store_ps(pz, _mm_add_ps(_mm_load_ps(pz), _mm_and_ps(live, _mm_load_ps(sz))));
+            l = 4;
+        }
+#endif
+        for (; l < 4; l++) {
+            if (!active[l]) {
+                continue;
+            }
+            const float a = opacity[l];
+            const float below = preintegrated ? 1.0f - a : (1.0f - a) * ca[l];
+            cr[l] = a * c_r[l] + below * cr[l];
+            cg[l] = a * c_g[l] + below * cg[l];
+            cb[l] = a * c_b[l] + below * cb[l];
+            ca[l] = a + (1.0f - a) * ca[l];
+            length[l] -= view.step_length;
+            px[l] += sx[l]; py[l] += sy[l]; pz[l] += sz[l];
+        }
+
+        // boundaries found by the secant method are opaque
+        for (l = 0; l < 4; l++) {
+            if (intersect[l] && opacity[l] > 0.0f) {
+                cr[l] = colour_intersection[l].x();
+                cg[l] = colour_intersection[l].y();
+                cb[l] = colour_intersection[l].z();
+                ca[l] = 1.0f;
+            }
+        }
+    }
+
+    for (int l = 0; l < 4; l++) {
+        dst[l][0] = std::pow(cr[l], 1.0f / view.gamma);
+        dst[l][1] = std::pow(cg[l], 1.0f / view.gamma);
+        dst[l][2] = std::pow(cb[l], 1.0f / view.gamma);
+        dst[l][3] = ca[l];
+    }
+}
+
+
+/*!
+ * \brief Sample the volume with trilinear mipmapping, as textureLod() does
+ * with GL_LINEAR_MIPMAP_LINEAR and GL_REPEAT. Slices are all alike, so
+ * only x and y are filtered.
+ */
+QVector4D CPURayCaster::sample_volume(const QVector3D& position, float lod) const
+{
+    const float s = position.x() * m_scale.x() + m_offset.x();
+    const float t = position.y() * m_scale.y() + m_offset.y();
+    if (lod <= 0.0f) {
+        return sample_level(0, s, t);
+    }
+    const int level = std::min((int) lod, m_volume.levels - 1);
+    const float f = lod - level;
+    const QVector4D a = sample_level(level, s, t);
+    if (f <= 0.0f || level + 1 >= m_volume.levels) {
+        return a;
+    }
+    const QVector4D b = sample_level(level + 1, s, t);
+    return QVector4D(lerp(a.x(), b.x(), f), lerp(a.y(), b.y(), f), lerp(a.z(), b.z(), f), lerp(a.w(), b.w(), f));
+}
+
+
+/*!
+ * \brief Bilinear sample of a mip level, wrapping around.
+ */
+QVector4D CPURayCaster::sample_level(int level, float s, float t) const
+{
+    const int w = std::max(m_volume.layout.texture_width >> level, 1);
+    const int h = std::max(m_volume.layout.texture_height >> level, 1);
+    const float u = s * w - 0.5f;
+    const float v = t * h - 0.5f;
+    const float fu = std::floor(u), fv = std::floor(v);
+    const float wu = u - fu, wv = v - fv;
+    const int i0 = wrap((int) fu, w), i1 = wrap((int) fu + 1, w);
+    const int j0 = wrap((int) fv, h), j1 = wrap((int) fv + 1, h);
+    const uint32_t *texels = m_mips[level].data();
+
+    const QVector4D p00 = unpack(texels[(size_t) j0 * w + i0]), p10 = unpack(texels[(size_t) j0 * w + i1]);
+    const QVector4D p01 = unpack(texels[(size_t) j1 * w + i0]), p11 = unpack(texels[(size_t) j1 * w + i1]);
+    QVector4D result;
+    for (int c = 0; c < 4; c++) {
+        result[c] = lerp(lerp(p00[c], p10[c], wu), lerp(p01[c], p11[c], wu), wv);
+    }
+    return result;
+}
+
+
+/*!
+ * \brief Opacity given by the segment TF, as segment_tf() in the shader.
+ */
+float CPURayCaster::segment_tf(float material) const
+{
+    const int n = CPURayCastVolume::MAX_NUM_SEGMENTS;
+    const float seg_id = (256.0f - material * 256.0f) / n;
+    const float u = seg_id * n - 0.5f;
+    const int i = std::floor(u);
+    return lerp(m_volume.segment_opacities[std::clamp(i, 0, n - 1)],
+                m_volume.segment_opacities[std::clamp(i + 1, 0, n - 1)], u - std::floor(u));
+}
+
+
+/*!
+ * \brief Opacity given by the pre-integrated segment TF, sampled bilinearly.
+ */
+float CPURayCaster::segment_tf_integrated(float material_front, float material) const
+{
+    const int n = 256;
+    const float u = std::clamp(material_front * 255.0f, 0.0f, n - 1.0f);
+    const float v = std::clamp(material * 255.0f, 0.0f, n - 1.0f);
+    const int i0 = u, j0 = v;
+    const int i1 = std::min(i0 + 1, n - 1), j1 = std::min(j0 + 1, n - 1);
+    const float *table = m_volume.preintegrated_tf.data();
+    return lerp(lerp(table[j0 * n + i0], table[j0 * n + i1], u - i0),
+                lerp(table[j1 * n + i0], table[j1 * n + i1], u - i0), v - j0);
+}
+
+
+/*!
+ * \brief Opacity given by polygons and slicing planes, as location_tf() in
+ * the shader; the polygon mask is sampled bilinearly and clamped.
+ */
+float CPURayCaster::location_tf(const QVector3D& position) const
+{
+    const VolumeClassifier& tfs = m_volume.location_tfs;
+    float opacity = 1.0f;
+    bool covered = false;
+
+    const int w = tfs.mask_width, h = tfs.mask_height;
+    for (size_t i = 0; i < tfs.layer_depths.size(); i++) {
+        if (position.z() < tfs.layer_depths[i].x() || position.z() > tfs.layer_depths[i].y()) {
+            continue;
+        }
+        const float u = std::clamp(position.x() * w - 0.5f, 0.0f, w - 1.0f);
+        const float v = std::clamp(position.y() * h - 0.5f, 0.0f, h - 1.0f);
+        const int i0 = u, j0 = v;
+        const int i1 = std::min(i0 + 1, w - 1), j1 = std::min(j0 + 1, h - 1);
+        const uint8_t *layer = &m_polygon_mask[(size_t) 2 * w * h * i];
+        float mask[2];
+        for (int c = 0; c < 2; c++) {
+            mask[c] = lerp(lerp(layer[2 * (j0 * w + i0) + c], layer[2 * (j0 * w + i1) + c], u - i0),
+                           lerp(layer[2 * (j1 * w + i0) + c], layer[2 * (j1 * w + i1) + c], u - i0), v - j0) / 255.0f;
+        }
+        if (mask[1] > 0.5f) {
+            opacity *= mask[0];
+            covered = true;
+        }
+    }
+    for (size_t i = 0; i < tfs.planes.size(); i++) {
+        if (QVector3D::dotProduct(tfs.planes[i].toVector3D(), position) <= tfs.planes[i].w()) {
+            opacity *= tfs.plane_opacities[i];
+            covered = true;
+        }
+    }
+    return covered ? opacity : tfs.volume_opacity;
+}
+
+
+/*!
+ * \brief Normal from the finite difference gradient of the material id.
+ */
+QVector3D CPURayCaster::normal(const RayCastView& view, const QVector3D& position, float material, float lod) const
+{
+    const float d = view.step_length / 10.0f;
+    const QVector3D gradient(sample_volume(position + QVector3D(d, 0, 0), lod).w() - material,
+                             sample_volume(position + QVector3D(0, d, 0), lod).w() - material,
+                             sample_volume(position + QVector3D(0, 0, d), lod).w() - material);
+    const float *N = view.normal_matrix.constData();
+    return -normalize(QVector3D(N[0] * gradient.x() + N[3] * gradient.y() + N[6] * gradient.z(),
+                                N[1] * gradient.x() + N[4] * gradient.y() + N[7] * gradient.z(),
+                                N[2] * gradient.x() + N[5] * gradient.y() + N[8] * gradient.z()));
+}
+
+
+/*!
+ * \brief Blinn-Phong shading of a sample, with the coefficients of its
+ * material as in the shader.
+ */
+QVector3D CPURayCaster::blinn_phong(const RayCastView& view, const QVector3D& position, const QVector4D& intensity,
+                                    const QVector3D& ray, float lod) const
+{
+    const float material = intensity.w();
+    const QVector3D L = normalize(view.light_position - position);
+    const QVector3D V = -normalize(ray);
+    const QVector3D N = normal(view, position, material, lod);
+    const QVector3D H = normalize(L + V);
+    const float NL = std::max(0.0f, QVector3D::dotProduct(N, L));
+    const float NH = std::max(0.0f, QVector3D::dotProduct(N, H));
+
+    float Ia = 0.1f, Id, Is;
+    const float id = material * 255.0f;
+    if (id == 253.0f) {             // nucleus
+        Id = 0.1f * NL;
+        Is = 1.0f * std::pow(NH, 5.0f);
+    } else if (id == 254.0f) {      // cytoplasm
+        Id = 0.6f * NL;
+        Is = 0.7f * std::pow(NH, 5.0f);
+    } else if (id == 255.0f) {      // rest
+        Id = 0.7f * NL;
+        Is = 0.0f;
+    } else if (id > 253.0f && id < 254.0f) {    // nucleus-cytoplasm boundary
+        Id = 0.35f * NL;
+        Is = 0.85f * std::pow(NH, 5.0f);
+    } else {                        // cytoplasm-rest boundary
+        Id = 0.65f * NL;
+        Is = 0.35f * std::pow(NH, 3.0f);
+    }
+    return (Ia + Id) * intensity.toVector3D() + Is * QVector3D(1.0f, 1.0f, 1.0f);
+}
+
+
+/*!
+ * \brief Secant search for the material boundary between two samples.
+ */
+QVector3D CPURayCaster::secant_method(QVector3D position, QVector3D position_next, QVector4D intensity,
+                                      QVector4D intensity_next, float p_iso, float lod, QVector4D& intensity_new) const
+{
+    QVector3D position_new = position;
+    intensity_new = intensity;
+    for (int i = 0; i < 4; i++) {
+        // the shader divides by zero here; its result is undefined anyway
+        if (intensity_next.w() == intensity.w()) {
+            break;
+        }
+        position_new = (position_next - position) * (p_iso - intensity.w()) / (intensity_next.w() - intensity.w()) + position;
+        intensity_new = sample_volume(position_new, lod);
+        if (intensity_new.w() == p_iso) {
+            break;
+        } else if (intensity_new.w() > p_iso) {
+            position = position_new;
+            intensity = intensity_new;
+        } else {
+            position_next = position_new;
+            intensity_next = intensity_new;
+        }
+    }
+    return position_new;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <QVector3D>
+#include <QVector4D>
+
+#include "raycastview.h"
+#include "tfbaker.h"
+
+/*!
+ * \brief Everything alpha_blending.frag samples, copied out of a
+ * RayCastVolume for the CPU raycaster.
+ */
+struct CPURayCastVolume {
+    const static int MAX_NUM_SEGMENTS = 3;
+
+    std::shared_ptr<const std::vector<uint32_t>> pixels;    /*!< One slice of the ring, as SharedVolume holds it. */
+    RingLayout layout;
+    int levels {1};                         /*!< Mip levels of the volume texture. */
+    QVector3D top, bottom;                  /*!< Bounding box, in model space. */
+
+    float segment_opacities[MAX_NUM_SEGMENTS];
+    std::vector<QVector4D> color_tfs;       /*!< Centre (0-255) and squared radius of each pick. */
+    std::vector<float> color_tf_opacities;
+    VolumeClassifier location_tfs;          /*!< Polygons, planes and volume opacity; colour TFs unused. */
+
+    bool lighting {false};
+    bool preintegrated {false};
+    std::vector<float> preintegrated_tf;    /*!< 256 x 256, as bake_preintegrated_tf() lays it out. */
+    float reference_step_length {0.01f};
+};
+
+/*!
+ * \brief Difference between two RGBA images, per 8 bit channel.
+ */
+struct ImageDifference {
+    int max {0};
+    double mean {0.0};
+    int64_t exceeding {0};      /*!< Channels differing by more than the tolerance. */
+};
+
+ImageDifference compare_images(const uint8_t *a, const uint8_t *b, int64_t pixels, int tolerance);
+
+/*!
+ * \brief CPU implementation of the alpha_blending.frag pipeline, as a
+ * fallback without a GPU and as a reference for the shader.
+ *
+ * Rays are marched in packets of four, one per pixel of a 2x2 quad, so that
+ * the volume level of detail comes from the same screen space derivatives
+ * as on the GPU. Tiles of the image are rendered in parallel.
+ *
+ * Follows the shader, with two exceptions: every colour pick is evaluated
+ * exactly, as the shader does for up to MAX_ANALYTIC_COLOR_TFS of them, and
+ * the TFs are always evaluated per sample, so pre-classified rendering is
+ * compared against what it approximates. Mip levels are reduced from the
+ * base level, while the volume texture takes them from the slide pyramid
+ * where it can.
+ */
+class CPURayCaster
+{
+public:
+    explicit CPURayCaster(CPURayCastVolume volume);
+
+    void render(const RayCastView& view, int width, int height, uint8_t *dst) const;
+
+private:
+    CPURayCastVolume m_volume;
+    std::vector<std::vector<uint32_t>> m_mips;  /*!< Ring slice at each level, level 0 included. */
+    std::vector<uint8_t> m_polygon_mask;        /*!< RG8 layers, as the polygon mask texture. */
+    QVector3D m_offset, m_scale;                /*!< Volume to ring texture coordinates. */
+    QVector3D m_texels;                         /*!< Texels of the base level per unit of volume coordinates. */
+
+    void render_quad(const RayCastView& view, int x, int y, float dst[4][4], bool covered[4]) const;
+    QVector4D sample_volume(const QVector3D& position, float lod) const;
+    QVector4D sample_level(int level, float s, float t) const;
+    float segment_tf(float material) const;
+    float segment_tf_integrated(float material_front, float material) const;
+    float location_tf(const QVector3D& position) const;
+    QVector3D normal(const RayCastView& view, const QVector3D& position, float material, float lod) const;
+    QVector3D blinn_phong(const RayCastView& view, const QVector3D& position, const QVector4D& intensity,
+                          const QVector3D& ray, float lod) const;
+    QVector3D secant_method(QVector3D position, QVector3D position_next, QVector4D intensity,
+                            QVector4D intensity_next, float p_iso, float lod, QVector4D& intensity_new) const;
+};
@@ -27,6 +27,8 @@
 
 int main(int argc, char *argv[])
 {
+    // canvases showing the same slide share its volume texture
+    QCoreApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
     QApplication a(argc, argv);
 
     QSurfaceFormat format;
@@ -22,6 +22,7 @@
 
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include "annotations.h"
 
 #include <QColorDialog>
 #include <QFileDialog>
@@ -111,6 +112,12 @@ void MainWindow::load_volume(const QString& path)
 
         ui->num_levels_label->setText((curr_level_label + "/" + max_level_label).c_str());
 
+        // the volume resets the segment opacities
+        for (QSlider *segment : {ui->segment_1_opacity, ui->segment_2_opacity, ui->segment_3_opacity}) {
+            const QSignalBlocker blocker(segment);
+            segment->setValue(segment->maximum());
+        }
+
     }
     catch (std::runtime_error& e) {
         QMessageBox::warning(this, tr("Error"), tr("Cannot load volume ") + path + ": " + e.what());
@@ -222,6 +229,16 @@ void MainWindow::on_enable_lighting_checkbox_clicked(bool value)
     ui->canvas->enable_lighting(value);
 }
 
+void MainWindow::on_preclassify_checkbox_clicked(bool value)
+{
+    ui->canvas->enable_preclassification(value);
+}
+
+void MainWindow::on_preintegrate_checkbox_clicked(bool value)
+{
+    ui->canvas->enable_preintegration(value);
+}
+
 /*!
  * \brief Open a dialog to choose the background colour.
  */
@@ -270,6 +287,13 @@ void MainWindow::mousePressEvent(QMouseEvent *event)
         connect(size_bar, &MyQSlider::valueChanged, size_bar, &MyQSlider::myValueChanged);
         connect(size_bar, &MyQSlider::myValueChangedWithId, ui->canvas, &RayCastCanvas::update_color_tf_size);
 
+        // baked TFs are previewed at low resolution while dragging
+        for (MyQSlider *bar : {opacity_bar, size_bar})
+        {
+            connect(bar, &MyQSlider::sliderPressed, ui->canvas, &RayCastCanvas::begin_tf_preview);
+            connect(bar, &MyQSlider::sliderReleased, ui->canvas, &RayCastCanvas::end_tf_preview);
+        }
+
         QLabel *o1 = new QLabel("Opacity:");
         QLabel *o2 = new QLabel("Distance:");
 
@@ -285,34 +309,98 @@ void MainWindow::mousePressEvent(QMouseEvent *event)
     }
     else if(space_checkbox->isChecked())
     {
-        int location_tf_id = location_tf_slider_count;
         QPointF pos = event->windowPos();
-        ui->canvas->set_space_proximity_tf(location_tf_id, pos.x(), pos.y(), event->buttons() & Qt::LeftButton, event->buttons() & Qt::RightButton);
+        const int location_tf_id = ui->canvas->set_space_proximity_tf(pos.x(), pos.y(), event->buttons() & Qt::LeftButton,
+                                                                      event->buttons() & Qt::RightButton);
 
         if (Qt::RightButton & event->buttons())
         {
-            int rows = prox_scroll_layout->rowCount();
-            QWidget *c = new QWidget;
-            QGridLayout *l = new QGridLayout(c);
-            QScrollArea *scroll = ui->scrollArea;
-            MyQSlider *opacity_bar = new MyQSlider(Qt::Horizontal);
-            const QString name = QString::fromStdString("opacity_bar_" + std::to_string(location_tf_id));
             printf("location tf id %d\n", location_tf_id);
-            opacity_bar->setObjectName(name);
-            connect(opacity_bar, &MyQSlider::valueChanged, opacity_bar, &MyQSlider::myValueChanged);
-            connect(opacity_bar, &MyQSlider::myValueChangedWithId, ui->canvas, &RayCastCanvas::update_location_tf_opacity);
-            QLabel *o = new QLabel("Opacity:");
-            l->addWidget(opacity_bar,0,1);
-            l->addWidget(o,0,0);
-
-            QLabel *label = new QLabel("Poly");
-            prox_scroll_layout->addWidget(label,rows,0);
-            prox_scroll_layout->addWidget(c,rows,1);
-            location_tf_slider_count++;
+            add_location_tf_controls(location_tf_id, "Poly", 0);
         }
     }
 }
 
+/*!
+ * \brief Add the opacity and depth sliders of a polygon to the TF list.
+ * \param id Id of the polygon.
+ * \param label Text shown next to the sliders.
+ * \param opacity Initial opacity, in percent, matching the polygon's.
+ */
+void MainWindow::add_location_tf_controls(int id, const QString& label, int opacity)
+{
+    int rows = prox_scroll_layout->rowCount();
+    QWidget *c = new QWidget;
+    QGridLayout *l = new QGridLayout(c);
+    MyQSlider *opacity_bar = new MyQSlider(Qt::Horizontal);
+    const QString name = QString::fromStdString("opacity_bar_" + std::to_string(id));
+    opacity_bar->setObjectName(name);
+    opacity_bar->setRange(0, 100);
+    opacity_bar->setValue(opacity);
+    connect(opacity_bar, &MyQSlider::valueChanged, opacity_bar, &MyQSlider::myValueChanged);
+    connect(opacity_bar, &MyQSlider::myValueChangedWithId, ui->canvas, &RayCastCanvas::update_location_tf_opacity);
+
+    // depth range the polygon is extruded over, whole volume by default
+    MyQSlider *depth_min_bar = new MyQSlider(Qt::Horizontal);
+    MyQSlider *depth_max_bar = new MyQSlider(Qt::Horizontal);
+    depth_min_bar->setObjectName(QString::fromStdString("depth_min_bar_" + std::to_string(id)));
+    depth_max_bar->setObjectName(QString::fromStdString("depth_max_bar_" + std::to_string(id)));
+    depth_min_bar->setRange(0, 100);
+    depth_max_bar->setRange(0, 100);
+    depth_min_bar->setValue(0);
+    depth_max_bar->setValue(100);
+    connect(depth_min_bar, &MyQSlider::valueChanged, depth_min_bar, &MyQSlider::myValueChanged);
+    connect(depth_min_bar, &MyQSlider::myValueChangedWithId, ui->canvas, &RayCastCanvas::update_polygon_depth_min);
+    connect(depth_max_bar, &MyQSlider::valueChanged, depth_max_bar, &MyQSlider::myValueChanged);
+    connect(depth_max_bar, &MyQSlider::myValueChangedWithId, ui->canvas, &RayCastCanvas::update_polygon_depth_max);
+
+    for (MyQSlider *bar : {opacity_bar, depth_min_bar, depth_max_bar})
+    {
+        connect(bar, &MyQSlider::sliderPressed, ui->canvas, &RayCastCanvas::begin_tf_preview);
+        connect(bar, &MyQSlider::sliderReleased, ui->canvas, &RayCastCanvas::end_tf_preview);
+    }
+
+    QLabel *o = new QLabel("Opacity:");
+    QLabel *d1 = new QLabel("Depth from:");
+    QLabel *d2 = new QLabel("Depth to:");
+    l->addWidget(opacity_bar,0,1);
+    l->addWidget(o,0,0);
+    l->addWidget(d1,1,0);
+    l->addWidget(depth_min_bar,1,1);
+    l->addWidget(d2,2,0);
+    l->addWidget(depth_max_bar,2,1);
+
+    prox_scroll_layout->addWidget(new QLabel(label),rows,0);
+    prox_scroll_layout->addWidget(c,rows,1);
+}
+
+/*!
+ * \brief Import the polygon annotations of a QuPath or ASAP export into the
+ * location TF, all visible.
+ */
+void MainWindow::on_import_annotations_button_clicked()
+{
+    const QString path = QFileDialog::getOpenFileName(this, tr("Import annotations"), ".",
+                                                      tr("Annotations (*.geojson *.json *.xml)"));
+    if (path.isNull())
+        return;
+
+    try {
+        const std::vector<Annotation> annotations = load_annotations(path);
+        // ids come from the canvas, which knows the one of a polygon being drawn
+        int first_id;
+        const int added = ui->canvas->import_annotations(annotations, first_id);
+        for (int i = 0; i < added; i++)
+        {
+            const Annotation& a = annotations[i];
+            add_location_tf_controls(first_id + i, a.name.isEmpty() ? (a.group.isEmpty() ? "Poly" : a.group) : a.name, 100);
+        }
+    }
+    catch (std::runtime_error& e) {
+        QMessageBox::warning(this, tr("Error"), tr("Cannot import annotations ") + path + ": " + e.what());
+    }
+}
+
 void MainWindow::on_volume_opacity_slider_valueChanged(int value)
 {
     ui->canvas->update_volume_opacity(value);
@@ -335,8 +423,15 @@ void MainWindow::on_light_z_position_valueChanged(int value)
 
 void MainWindow::on_add_slicing_plane_button_clicked()
 {
+    // the shader has room for a fixed number of planes
+    if (!ui->canvas->add_new_slicing_plane(slicing_planes_count))
+    {
+        QMessageBox::warning(this, tr("Error"), tr("At most %1 slicing planes can be added.")
+                             .arg(RayCastVolume::MAX_SLICING_PLANES));
+        return;
+    }
     int slicing_plane_id = slicing_planes_count++;
-    ui->canvas->add_new_slicing_plane(slicing_plane_id);
+    ui->add_slicing_plane_button->setEnabled(slicing_planes_count < RayCastVolume::MAX_SLICING_PLANES);
 
     int rows = prox_scroll_layout->rowCount();
     QWidget *c = new QWidget;
@@ -364,6 +459,16 @@ void MainWindow::on_add_slicing_plane_button_clicked()
     const QString bname = QString::fromStdString("invertbutton" + std::to_string(slicing_plane_id));
     invert_button->setObjectName(bname);
 
+    // tilt about the two axes perpendicular to the orientation, in degrees
+    MyQSlider *tilt_u_bar = new MyQSlider(Qt::Horizontal);
+    MyQSlider *tilt_v_bar = new MyQSlider(Qt::Horizontal);
+    tilt_u_bar->setObjectName(QString::fromStdString("tilt_u_bar" + std::to_string(slicing_plane_id)));
+    tilt_v_bar->setObjectName(QString::fromStdString("tilt_v_bar" + std::to_string(slicing_plane_id)));
+    tilt_u_bar->setRange(-90, 90);
+    tilt_v_bar->setRange(-90, 90);
+    tilt_u_bar->setValue(0);
+    tilt_v_bar->setValue(0);
+
 
     connect(distance_bar, &MyQSlider::valueChanged, distance_bar, &MyQSlider::myValueChanged);
     connect(distance_bar, &MyQSlider::myValueChangedWithId, ui->canvas, &RayCastCanvas::update_slicing_plane_distance);
@@ -377,6 +482,11 @@ void MainWindow::on_add_slicing_plane_button_clicked()
     connect(invert_button, &MyQPushButton::clicked, invert_button, &MyQPushButton::myClicked);
     connect(invert_button, &MyQPushButton::myClickedWithName, ui->canvas, &RayCastCanvas::update_slicing_plane_invert);
 
+    connect(tilt_u_bar, &MyQSlider::valueChanged, tilt_u_bar, &MyQSlider::myValueChanged);
+    connect(tilt_u_bar, &MyQSlider::myValueChangedWithId, ui->canvas, &RayCastCanvas::update_slicing_plane_tilt);
+    connect(tilt_v_bar, &MyQSlider::valueChanged, tilt_v_bar, &MyQSlider::myValueChanged);
+    connect(tilt_v_bar, &MyQSlider::myValueChangedWithId, ui->canvas, &RayCastCanvas::update_slicing_plane_tilt);
+
     QLabel *o1 = new QLabel("Opacity:");
     QLabel *o2 = new QLabel("Distance:");
     l->addWidget(o1,0,0);
@@ -387,6 +497,13 @@ void MainWindow::on_add_slicing_plane_button_clicked()
     l->addWidget(distance_bar,1,1);
     l->addWidget(dropdown,2,1);
 
+    QLabel *o3 = new QLabel("Tilt:");
+    QLabel *o4 = new QLabel("Tilt:");
+    l->addWidget(o3,3,0);
+    l->addWidget(tilt_u_bar,3,1);
+    l->addWidget(o4,4,0);
+    l->addWidget(tilt_v_bar,4,1);
+
     QLabel *label = new QLabel("Plane");
     prox_scroll_layout->addWidget(label,rows,0);
     prox_scroll_layout->addWidget(c,rows,1);
@@ -80,6 +80,8 @@ private slots:
 
     void on_add_slicing_plane_button_clicked();
 
+    void on_import_annotations_button_clicked();
+
     void on_segment_1_opacity_valueChanged(int value);
 
     void on_segment_2_opacity_valueChanged(int value);
@@ -88,6 +90,10 @@ private slots:
 
     void on_enable_lighting_checkbox_clicked(bool value);
 
+    void on_preclassify_checkbox_clicked(bool value);
+
+    void on_preintegrate_checkbox_clicked(bool value);
+
     void on_volume_opacity_slider_valueChanged(int value);
 
     void on_light_x_position_valueChanged(int value);
@@ -98,11 +104,12 @@ private slots:
 
 
 private:
+    void add_location_tf_controls(int id, const QString& label, int opacity);
+
     std::string curr_level_label, max_level_label;
     int i = 0;
     QGridLayout *prox_scroll_layout = nullptr;
     QWidget *prox_scroll_layout_main = nullptr;
     int color_tf_slider_count = 0;    // number of color tfs - used to assign slider ids
-    int location_tf_slider_count = 0;    // number of location tfs - used to assign slider ids
     int slicing_planes_count = 0;    // number of slicing planes - used to assigne ids
 };
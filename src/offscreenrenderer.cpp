@@ -0,0 +1,115 @@
+#include "offscreenrenderer.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <QElapsedTimer>
+
+/*!
+ * \brief Create the context and a \p width x \p height framebuffer.
+ */
+OffscreenRenderer::OffscreenRenderer(int width, int height)
+    : m_width {width}
+    , m_height {height}
+{
+    m_surface.setFormat(QSurfaceFormat::defaultFormat());
+    m_surface.create();
+    m_context.setFormat(QSurfaceFormat::defaultFormat());
+    if (!m_surface.isValid() || !m_context.create() || !m_context.makeCurrent(&m_surface)) {
+        throw std::runtime_error("Cannot create an OpenGL context.");
+    }
+    initializeOpenGLFunctions();
+
+    m_fbo.reset(new QOpenGLFramebufferObject(width, height, QOpenGLFramebufferObject::Depth));
+    if (!m_fbo->isValid() || !m_fbo->bind()) {
+        throw std::runtime_error("Cannot create a " + std::to_string(width) + "x"
+                                 + std::to_string(height) + " framebuffer.");
+    }
+
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glViewport(0, 0, width, height);
+
+    m_volume.reset(new RayCastVolume());
+    m_volume->create_noise();
+
+    m_shader.reset(new QOpenGLShaderProgram());
+    if (!m_shader->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shaders/alpha_blending.vert")
+            || !m_shader->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shaders/alpha_blending.frag")
+            || !m_shader->link()) {
+        throw std::runtime_error("Cannot build the raycasting shader: " + m_shader->log().toStdString());
+    }
+}
+
+
+/*!
+ * \brief Destructor.
+ */
+OffscreenRenderer::~OffscreenRenderer()
+{
+    // GL objects are released with the context current
+    m_context.makeCurrent(&m_surface);
+    m_volume.reset();
+    m_shader.reset();
+    m_fbo.reset();
+    m_context.doneCurrent();
+}
+
+
+/*!
+ * \brief Draw until the TF bakes and texture uploads in flight have landed,
+ * as the canvas does by repainting, so the next frame is the final one.
+ * \return False if uploads were still pending after \p timeout_ms.
+ */
+bool OffscreenRenderer::settle(const RayCastView& view, int timeout_ms)
+{
+    QElapsedTimer timer;
+    timer.start();
+    for (;;) {
+        m_volume->flush_tf_updates();
+        m_volume->raycast(*m_shader, view);
+        glFinish();
+        if (!m_volume->uploads_pending()) {
+            return true;
+        }
+        if (timer.elapsed() > timeout_ms) {
+            return false;
+        }
+        // let the TF workers run
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+
+/*!
+ * \brief Draw one frame, applying the TF updates made since the last one.
+ * \return Time to the end of the frame on the GPU, in milliseconds.
+ */
+double OffscreenRenderer::draw(const RayCastView& view)
+{
+    glFinish();
+    QElapsedTimer timer;
+    timer.start();
+    m_volume->flush_tf_updates();
+    m_volume->raycast(*m_shader, view);
+    glFinish();
+    return timer.nsecsElapsed() / 1e6;
+}
+
+
+/*!
+ * \brief Read back the last frame.
+ *
+ * Opaque, like the canvas shows it: the alpha the shader accumulates is
+ * dropped rather than composited.
+ */
+QImage OffscreenRenderer::image()
+{
+    QImage image(m_width, m_height, QImage::Format_RGBA8888);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, image.bits());
+    // GL rows run bottom up
+    return image.mirrored().convertToFormat(QImage::Format_RGBX8888);
+}
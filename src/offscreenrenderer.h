@@ -0,0 +1,57 @@
+#pragma once
+
+#include <memory>
+
+#include <QImage>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLShaderProgram>
+
+#include "raycastview.h"
+#include "raycastvolume.h"
+
+/*!
+ * \brief Renders a RayCastVolume into an offscreen framebuffer, without a
+ * window.
+ *
+ * Owns its own OpenGL context, with the default surface format, on a
+ * QOffscreenSurface; on display-less hosts run with QT_QPA_PLATFORM=offscreen
+ * (or eglfs), so Qt creates it through EGL. Draws with the same shaders as
+ * the canvas, and through RayCastVolume::raycast() with the same uniforms.
+ *
+ * Throws std::runtime_error if the context, the framebuffer or the shaders
+ * cannot be created.
+ */
+class OffscreenRenderer : protected QOpenGLExtraFunctions
+{
+public:
+    OffscreenRenderer(int width, int height);
+    virtual ~OffscreenRenderer();
+
+    OffscreenRenderer(const OffscreenRenderer&) = delete;
+    OffscreenRenderer& operator=(const OffscreenRenderer&) = delete;
+
+    /*!
+     * \brief The volume drawn, to load slides and set TFs on. The context is
+     * current while the renderer exists.
+     */
+    RayCastVolume& volume() { return *m_volume; }
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+    bool settle(const RayCastView& view, int timeout_ms);
+    double draw(const RayCastView& view);
+    QImage image();
+
+private:
+    int m_width;
+    int m_height;
+    QOffscreenSurface m_surface;
+    QOpenGLContext m_context;
+    std::unique_ptr<QOpenGLFramebufferObject> m_fbo;
+    std::unique_ptr<QOpenGLShaderProgram> m_shader;
+    std::unique_ptr<RayCastVolume> m_volume;
+};
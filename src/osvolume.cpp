@@ -1,5 +1,51 @@
 #include "osvolume.h"
 
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// convert openslide's premultiplied ARGB words to straight RGBA bytes in memory
+// order, which GL takes as GL_RGBA / GL_UNSIGNED_BYTE without conversion
+void convert_to_rgba8(uint32_t *pixels, int64_t n)
+{
+    int64_t i = 0;
+#ifdef __SSE2__
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128 max = _mm_set1_ps(255.0f);
+    for (; i + 4 <= n; i += 4) {
+        __m128i p = _mm_loadu_si128(reinterpret_cast<__m128i*>(pixels + i));
+        __m128i a = _mm_srli_epi32(p, 24);
+        __m128 af = _mm_cvtepi32_ps(a);
+        // 255 / alpha, or 0 for fully transparent pixels
+        __m128 scale = _mm_and_ps(_mm_div_ps(max, af), _mm_cmpneq_ps(af, _mm_setzero_ps()));
+
+        __m128 r = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 16), mask));
+        __m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 8), mask));
+        __m128 b = _mm_cvtepi32_ps(_mm_and_si128(p, mask));
+        __m128i ri = _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(r, scale), max));
+        __m128i gi = _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(g, scale), max));
+        __m128i bi = _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(b, scale), max));
+
+        __m128i out = _mm_or_si128(_mm_or_si128(ri, _mm_slli_epi32(gi, 8)),
+                                   _mm_or_si128(_mm_slli_epi32(bi, 16), _mm_slli_epi32(a, 24)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + i), out);
+    }
+#endif
+    for (; i < n; i++) {
+        const uint32_t p = pixels[i];
+        const uint32_t a = p >> 24;
+        const float scale = a ? 255.0f / a : 0.0f;
+        const uint32_t r = std::lrint(std::min(((p >> 16) & 0xff) * scale, 255.0f));
+        const uint32_t g = std::lrint(std::min(((p >> 8) & 0xff) * scale, 255.0f));
+        const uint32_t b = std::lrint(std::min((p & 0xff) * scale, 255.0f));
+        const uint8_t bytes[4] = {(uint8_t) r, (uint8_t) g, (uint8_t) b, (uint8_t) a};
+        std::copy(bytes, bytes + 4, reinterpret_cast<uint8_t*>(pixels + i));
+    }
+}
+
 OSVolume::OSVolume(const std::string& filename)
 {
     image = openslide_open(filename.c_str());
@@ -8,16 +54,16 @@ OSVolume::OSVolume(const std::string& filename)
 
     store_level_info(image, levels);
 
-    // lowest resolution is loaded fully initially.
-    // Be careful while changing this - low_res_data values and width/depth/height are initialized based on this.
+    // lowest resolution is shown fully initially.
     _curr_level = levels-1;
     _scaling_factor = QVector3D(1.0, 1.0, 1.0);
     _scaling_offset = QVector3D(0.0, 0.0, 0.0);
     load_volume(_curr_level);
+}
 
-    _low_res_data = _data;
-    _low_res_size = QVector3D(level_info[_curr_level]["width"], level_info[_curr_level]["height"], level_info[_curr_level]["depth"]);
-
+OSVolume::~OSVolume()
+{
+    openslide_close(image);
 }
 
 QVector3D OSVolume::size()
@@ -29,26 +75,11 @@ QVector3D OSVolume::size()
     );
 }
 
+// select the level to be shown; its pixels are read on demand with read_region()
 void OSVolume::load_volume(int l)
 {
-    _data = nullptr;
-
     _curr_level = l;
 
-    int64_t width = level_info[_curr_level]["width"]*_scaling_factor.x();
-    int64_t height = level_info[_curr_level]["height"]*_scaling_factor.y();
-
-    int w_offset = level_info[_curr_level]["width"]*_scaling_offset.x();
-    int h_offset = level_info[_curr_level]["height"]*_scaling_offset.y();
-
-	long long int size = width*height*sizeof(uint32_t);
-    _data = (uint32_t*)malloc(size);
-
-
-    openslide_read_region(image, _data, w_offset, h_offset, _curr_level, width, height);
-
-    duplicate_data(&_data);
-
     printf("\nImage loaded! Levels: %d Width: %ld Height: %ld Depth: %ld Current Level: %d\n\n", levels,
             level_info[_curr_level]["width"],
             level_info[_curr_level]["height"],
@@ -57,22 +88,45 @@ void OSVolume::load_volume(int l)
     );
 }
 
-// duplicate data "depth" times
-void OSVolume::duplicate_data(uint32_t** d)
+OSVolume::Region OSVolume::region()
+{
+    Region r;
+    r.level = _curr_level;
+    r.width = level_info[_curr_level]["width"]*_scaling_factor.x();
+    r.height = level_info[_curr_level]["height"]*_scaling_factor.y();
+    r.depth = level_info[_curr_level]["depth"]*_scaling_factor.z();
+    r.x = level_info[_curr_level]["width"]*_scaling_offset.x();
+    r.y = level_info[_curr_level]["height"]*_scaling_offset.y();
+    return r;
+}
+
+// read a single slice as straight (not premultiplied) RGBA bytes;
+// x and y are in pixels of the given level. Pixels outside the slide are transparent.
+void OSVolume::read_region(int level, int64_t x, int64_t y, int64_t width, int64_t height, uint32_t *dest)
+{
+    // openslide expects the top left corner in level 0 coordinates
+    double downsample = openslide_get_level_downsample(image, level);
+    openslide_read_region(image, dest, x*downsample, y*downsample, level, width, height);
+    convert_to_rgba8(dest, width*height);
+}
+
+// coarser pyramid level whose downsample is factor times that of the given
+// level, or -1 if the slide has none
+int OSVolume::matching_level(int level, int factor)
 {
-    int64_t width = level_info[_curr_level]["width"]*_scaling_factor.x();
-    int64_t height = level_info[_curr_level]["height"]*_scaling_factor.y();
-    int64_t depth = level_info[_curr_level]["depth"]*_scaling_factor.z();
+    const double target = openslide_get_level_downsample(image, level) * factor;
+    for (int i = level + 1; i < levels; i++)
+    {
+        if (std::abs(openslide_get_level_downsample(image, i) - target) <= 0.01 * target)
+            return i;
+    }
+    return -1;
+}
 
-    std::vector<uint32_t> *data3d = new std::vector<uint32_t>(*d, *d + width*height);
-    std::vector<uint32_t> temp(data3d->begin(), data3d->end());
-    for(int i = 0; i < depth-1; i++)
-        std::copy(data3d->begin(),data3d->end(), std::back_inserter(temp));
-    std::swap(temp, *data3d);
-    // clear memory
-    temp = std::vector<uint32_t>();
-    free(*d);
-    *d = &(*data3d)[0];
+// scale of the given level relative to the full resolution level 0
+double OSVolume::level_downsample(int level)
+{
+    return openslide_get_level_downsample(image, level);
 }
 
 void OSVolume::store_level_info(openslide_t* image, int levels)
@@ -114,8 +168,6 @@ int OSVolume::load_best_res()
         {
             if (_curr_level == i) break;
 
-            if (_data != _low_res_data)
-                free(_data);
             load_volume(i);
             break;
         }
@@ -123,39 +175,6 @@ int OSVolume::load_best_res()
     return _curr_level;
 }
 
-uint32_t *OSVolume::zoomed_in(uint32_t *data)
-{
-    // no zooming required
-    if (_scaling_factor.x() == 1.0 && _scaling_factor.y() == 1.0 && _scaling_factor.z() == 1.0)
-        return data;
-
-    int64_t width = level_info[_curr_level]["width"];
-    int64_t height = level_info[_curr_level]["height"];
-    int64_t depth = level_info[_curr_level]["depth"];
-
-    int w_small = level_info[_curr_level]["width"]*_scaling_factor.x();
-    int h_small = level_info[_curr_level]["height"]*_scaling_factor.y();
-    int d_small = level_info[_curr_level]["depth"]*_scaling_factor.z();
-
-    int w_offset = level_info[_curr_level]["width"]*_scaling_offset.x();
-    int h_offset = level_info[_curr_level]["height"]*_scaling_offset.y();
-    int d_offset = level_info[_curr_level]["depth"]*_scaling_offset.z();
-
-    uint32_t* zoomed_in = (uint32_t*)malloc(w_small*h_small*d_small*sizeof(uint32_t));
-
-    int ptr = 0;
-    for(int i = d_offset; i < d_small; i++)
-    {
-        for(int j = h_offset; j < h_small; j++)
-        {
-            std::copy(_low_res_data+w_offset + (j*width) + (i*width*height), _low_res_data+w_offset + w_small + (j*width) + (i*width*height), zoomed_in+ptr);
-            ptr += w_small;
-        }
-    }
-
-    return zoomed_in;
-}
-
 void OSVolume::zoom_in()
 {
     if (_scaling_factor.x() <= 0.01 || _scaling_factor.y() <= 0.01 || _scaling_factor.z() <= 0.01)
@@ -191,14 +210,6 @@ void OSVolume::switch_to_low_res()
     _curr_level = levels-1;
 }
 
-uint32_t* OSVolume::data()
-{
-    if (_curr_level == levels-1)
-        return zoomed_in();
-    return _data;
-}
-
-
 void OSVolume::move_up()
 {
     _scaling_offset.setY(_scaling_offset.y()+4*_scaling_offset_value);
@@ -223,21 +234,3 @@ void OSVolume::move_left()
     if (_scaling_offset.x() < 0.0) _scaling_offset.setX(0.0);
 
 }
-
-uint32_t* OSVolume::zoomed_in()
-{
-    int w_small = level_info[_curr_level]["width"]*_scaling_factor.x();
-    int h_small = level_info[_curr_level]["height"]*_scaling_factor.y();
-    int d_small = level_info[_curr_level]["depth"]*_scaling_factor.z();
-
-    int w_offset = level_info[_curr_level]["width"]*_scaling_offset.x();
-    int h_offset = level_info[_curr_level]["height"]*_scaling_offset.y();
-    int d_offset = level_info[_curr_level]["depth"]*_scaling_offset.z();
-
-	long long int size = w_small*h_small*sizeof(uint32_t);
-    uint32_t* d = (uint32_t*)malloc(size);
-
-    openslide_read_region(image, d, w_offset, h_offset, _curr_level, w_small, h_small);
-    duplicate_data(&d);
-    return d;
-}
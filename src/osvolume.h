@@ -1,3 +1,5 @@
+#pragma once
+
 #include <string>
 #include <vector>
 #include <map>
@@ -5,10 +7,15 @@
 #include <QVector3D>
 #include <openslide/openslide.h>
 
+// convert premultiplied ARGB words, as openslide returns them, to straight
+// RGBA bytes in place
+void convert_to_rgba8(uint32_t *pixels, int64_t n);
+
 class OSVolume {
 
     public:
     OSVolume(const std::string& filename);
+    ~OSVolume();
 
     QVector3D size();
 
@@ -16,7 +23,20 @@ class OSVolume {
 
     int levels, _curr_level;
 
-    uint32_t *data();
+    // window of the slide to be shown, in pixels of the current level
+    struct Region {
+        int level;
+        int64_t x, y;
+        int64_t width, height, depth;
+    };
+
+    Region region();
+
+    void read_region(int level, int64_t x, int64_t y, int64_t width, int64_t height, uint32_t *dest);
+
+    int matching_level(int level, int factor);
+
+    double level_downsample(int level);
 
     void zoom_in();
 
@@ -39,10 +59,6 @@ class OSVolume {
 
 
     private:
-    uint32_t* _data;    // contains the rendered sub-volume based on scaling factors and offsets
-    uint32_t* _low_res_data;    // Always contains the entire low-res volume. Never cropped.
-    QVector3D _low_res_size;
-
     // scaling and offset as a fraction of the original full volume;
     // used for determining size of zoomed-in volume
     // z scaling and offset are ignored for now
@@ -51,8 +67,6 @@ class OSVolume {
     double _scaling_factor_value = 0.06;
     double _scaling_offset_value = 0.03;
 
-    uint32_t* zoomed_in(uint32_t* data);
-
     openslide_t* image;
 
     // map keys: width, height, size, num_voxels
@@ -67,8 +81,6 @@ class OSVolume {
     void determine_best_level();
     void store_level_info(openslide_t* image, int levels);
     void load_volume(int l);
-    void duplicate_data(uint32_t** d);
-    uint32_t* zoomed_in();
 
 
 };
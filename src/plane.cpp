@@ -1,27 +1,36 @@
 #include "plane.h"
 
-bool Plane::point_is_inside(float x, float y, float z)
-{
-    bool left = true;
-    if (orientation == 0)
-    {
-        if (x > distance)
-            left = false;
-    }
-    else if (orientation == 1)
-    {
-        if (y > distance)
-            left = false;
+#include <cmath>
 
-    }
-    else if (orientation == 2)
-    {
-        if (z > distance)
-            left = false;
+// unit normal pointing away from the "left" side
+QVector3D Plane::normal()
+{
+    float n[3];
+    const int u = (orientation + 1) % 3;
+    const int v = (orientation + 2) % 3;
+    n[orientation] = std::cos(tilt_u) * std::cos(tilt_v);
+    n[u] = std::sin(tilt_u);
+    n[v] = std::cos(tilt_u) * std::sin(tilt_v);
+    return QVector3D(n[0], n[1], n[2]);
+}
 
-    }
+// plane equation (normal, offset) such that a point p is hidden where
+// dot(normal, p) <= offset
+QVector4D Plane::equation()
+{
+    // the plane pivots around the point on the volume's centre line
+    float c[3] = {0.5f, 0.5f, 0.5f};
+    c[orientation] = distance;
+    const QVector3D n = normal();
+    const float offset = QVector3D::dotProduct(n, QVector3D(c[0], c[1], c[2]));
     if (hide_left)
-        return left;
+        return QVector4D(n, offset);
     else
-        return !left;
+        return QVector4D(-n, -offset);
+}
+
+bool Plane::point_is_inside(float x, float y, float z)
+{
+    const QVector4D e = equation();
+    return e.x()*x + e.y()*y + e.z()*z <= e.w();
 }
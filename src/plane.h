@@ -3,7 +3,12 @@
 
 #include<cstdio>
 #include<vector>
+#include<QVector3D>
+#include<QVector4D>
 
+// Slicing plane through the volume, in volume coordinates [0, 1]^3.
+// The plane is perpendicular to one axis at the given distance, optionally
+// tilted by two angles about the other axes, and hides one side.
 class Plane {
     public:
     int id;
@@ -15,16 +20,23 @@ class Plane {
         orientation = 0;
         opacity = 0.0;
         distance = 0.1;
+        tilt_u = 0.0;
+        tilt_v = 0.0;
         hide_left = true;
     }
     void invert(){hide_left = !hide_left;}
     void update_orientation(int o) { orientation = o;; }
     void update_distance(float d) {distance = d;}
+    void update_tilt(int axis, float radians) { if (axis == 0) tilt_u = radians; else tilt_v = radians; }
     bool point_is_inside(float x, float y, float z);
+    QVector4D equation();
 
     private:
     int orientation; // 0,1,2 for x,y,z respectively
     float distance;
+    float tilt_u, tilt_v;   // about the next two axes, in radians
 
     bool hide_left; // used to invert direction that slicing plane hides stuff in
+
+    QVector3D normal();
 };
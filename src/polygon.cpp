@@ -1,5 +1,8 @@
 #include "polygon.h"
 
+#include <algorithm>
+#include <cmath>
+
 // PNPOLY
 // https://wrf.ecse.rpi.edu//Research/Short_Notes/pnpoly.html#The%20C%20Code
 bool Polygon::point_is_inside(float x, float y)
@@ -14,3 +17,88 @@ bool Polygon::point_is_inside(float x, float y)
     }
     return c;
 }
+
+// axis aligned bounding box in the x-y plane; false if there are no vertices
+bool Polygon::bounds(float& min_x, float& min_y, float& max_x, float& max_y)
+{
+    if (vertices.empty())
+        return false;
+
+    min_x = max_x = vertices[0].x();
+    min_y = max_y = vertices[0].y();
+    for (const QVector3D& v : vertices) {
+        min_x = std::min(min_x, v.x());
+        min_y = std::min(min_y, v.y());
+        max_x = std::max(max_x, v.x());
+        max_y = std::max(max_y, v.y());
+    }
+    return true;
+}
+
+// bucket the edges by the rows whose sample line they cross; only the rows
+// within the bounding box are stored, so many small polygons stay cheap
+void Polygon::build_edge_table(int height)
+{
+    float min_x, min_y, max_x, max_y;
+    edge_table.clear();
+    if (!bounds(min_x, min_y, max_x, max_y))
+        return;
+    edge_table_first = std::clamp((int) std::floor(min_y*height) - 1, 0, height);
+    const int rows = std::clamp((int) std::ceil(max_y*height) + 2, 0, height) - edge_table_first;
+    edge_table.assign(std::max(rows, 0), std::vector<int>());
+
+    int nvert = vertices.size();
+    for (int i = 0, j = nvert-1; i < nvert; j = i++) {
+        const float y0 = std::min(vertices[i].y(), vertices[j].y());
+        const float y1 = std::max(vertices[i].y(), vertices[j].y());
+        if (y0 == y1)
+            continue;
+
+        // one row of slack on each side, row_spans tests the exact condition
+        const int first = std::max(edge_table_first, (int) std::floor(y0*height) - 1);
+        const int last = std::min(edge_table_first + (int) edge_table.size() - 1, (int) std::ceil(y1*height) + 1);
+        for (int row = first; row <= last; row++)
+            edge_table[row - edge_table_first].push_back(i);
+    }
+}
+
+// half-open column ranges [begin, end) of row j that lie inside the polygon;
+// build_edge_table(height) must have been called
+void Polygon::row_spans(int j, int width, int height, std::vector<std::pair<int, int>>& spans)
+{
+    spans.clear();
+    const float y = j/(float)height;
+    int nvert = vertices.size();
+
+    // rows outside the bounding box are not crossed
+    const int row = j - edge_table_first;
+    if (row < 0 || row >= (int) edge_table.size())
+        return;
+
+    // crossings of the sample line, computed exactly as in PNPOLY
+    std::vector<float> crossings;
+    for (int i : edge_table[row]) {
+        const int k = i == 0 ? nvert-1 : i-1;
+        if ((vertices[i].y()>y) != (vertices[k].y()>y))
+            crossings.push_back((vertices[k].x()-vertices[i].x()) * (y-vertices[i].y()) / (vertices[k].y()-vertices[i].y()) + vertices[i].x());
+    }
+    std::sort(crossings.begin(), crossings.end());
+
+    // a point is inside when an odd number of crossings lie to its right,
+    // i.e. when crossings[2n] <= x < crossings[2n+1]
+    auto first_column = [width](float x) {
+        // first i with i/width >= x, evaluated as in point_is_inside
+        int i = std::clamp((int) std::ceil(x*width), 0, width);
+        while (i > 0 && (i-1)/(float)width >= x)
+            i--;
+        while (i < width && i/(float)width < x)
+            i++;
+        return i;
+    };
+    for (size_t n = 0; n + 1 < crossings.size(); n += 2) {
+        const int begin = first_column(crossings[n]);
+        const int end = first_column(crossings[n+1]);
+        if (begin < end)
+            spans.push_back(std::make_pair(begin, end));
+    }
+}
@@ -2,12 +2,14 @@
 #pragma once
 
 #include<cstdio>
+#include<utility>
 #include<vector>
+#include<QPointF>
 #include<QVector3D>
 
 // Polygons for location based TF
 // location stored relative to model space of volume
-// currently only support for polygons parallel to volume
+// polygons are parallel to the volume, extruded over a depth range
 class Polygon
 {
     public:
@@ -15,13 +17,40 @@ class Polygon
             vertices.push_back(QVector3D(x,y,z));
             id = ID;
         }
+        // replace the outline at once, e.g. with an imported annotation;
+        // several rings joined through a common vertex (see Annotation) are
+        // filled with the even-odd rule
+        void set_vertices(int ID, std::vector<QVector3D> v){
+            vertices = std::move(v);
+            id = ID;
+        }
+        // outline of an imported annotation, in pixels of the slide's full
+        // resolution level; the vertices follow it as the region changes
+        void set_slide_vertices(std::vector<QPointF> v){slide_vertices = std::move(v);}
+        const std::vector<QPointF>& get_slide_vertices(){return slide_vertices;}
         void set_opacity(float o){opacity = o;};
         float get_opacity(){return opacity;}
+        // depth range the polygon applies to, in volume coordinates
+        void set_depth_range(float min, float max){depth_min = min; depth_max = max;}
+        float get_depth_min(){return depth_min;}
+        float get_depth_max(){return depth_max;}
+        const std::vector<QVector3D>& get_vertices(){return vertices;}
         bool point_is_inside(float x, float y);
+        bool bounds(float& min_x, float& min_y, float& max_x, float& max_y);
+
+        // scan conversion on the grid of sample points (i/width, j/height),
+        // giving the same result as point_is_inside
+        void build_edge_table(int height);
+        void row_spans(int j, int width, int height, std::vector<std::pair<int, int>>& spans);
         int id;
     private:
         float opacity = 0.0f;
+        float depth_min = 0.0f;
+        float depth_max = 1.0f;
         std::vector<QVector3D> vertices;
+        std::vector<QPointF> slide_vertices;       // empty unless imported
+        std::vector<std::vector<int>> edge_table;  // edges (by first vertex) crossing each row
+        int edge_table_first = 0;                  // row of edge_table[0], the first the polygon spans
         bool enabled = true;
 
 };
@@ -34,15 +34,6 @@
 #include "GL/glu.h"
 
 
-/*!
- * \brief Convert a QColor to a QVector3D.
- * \return A QVector3D holding a RGB representation of the colour.
- */
-QVector3D to_vector3d(const QColor& colour) {
-    return QVector3D(colour.redF(), colour.greenF(), colour.blueF());
-}
-
-
 /*!
  * \brief Constructor for the canvas.
  * \param parent Parent widget.
@@ -57,6 +48,13 @@ RayCastCanvas::RayCastCanvas(QWidget *parent)
     //m_modes["MIP"] = [&]() { RayCastCanvas::raycasting("MIP"); };
     // set default mode to alpha blending
     m_active_mode = "Alpha blending";
+
+    m_tf_preview_idle.setSingleShot(true);
+    m_tf_preview_idle.setInterval(TF_PREVIEW_IDLE_MS);
+    connect(&m_tf_preview_idle, &QTimer::timeout, this, [this]() {
+        m_raycasting_volume->set_tf_preview(false);
+        update();
+    });
 }
 
 
@@ -65,10 +63,13 @@ RayCastCanvas::RayCastCanvas(QWidget *parent)
  */
 RayCastCanvas::~RayCastCanvas()
 {
+    // the last view of a slide releases the shared volume texture
+    makeCurrent();
     for (auto& [key, val] : m_shaders) {
         delete val;
     }
     delete m_raycasting_volume;
+    doneCurrent();
 }
 
 
@@ -98,8 +99,6 @@ void RayCastCanvas::initializeGL()
 void RayCastCanvas::resizeGL(int w, int h)
 {
     (void) w; (void) h;
-    m_viewportSize = {(float) scaled_width(), (float) scaled_height()};
-    m_aspectRatio = (float) scaled_width() / scaled_height();
     glViewport(0, 0, scaled_width(), scaled_height());
     m_raycasting_volume->create_noise();
 }
@@ -111,20 +110,19 @@ void RayCastCanvas::resizeGL(int w, int h)
 void RayCastCanvas::paintGL()
 {
     // Compute geometry
-    m_viewMatrix.setToIdentity();
-    m_viewMatrix.translate(0, 0, -4.0f * std::exp(m_distExp / 600.0f));
-    m_viewMatrix.rotate(m_trackBall.rotation());
+    m_view.set_camera(m_trackBall.rotation(), m_distExp, m_raycasting_volume->modelMatrix(),
+                      scaled_width(), scaled_height());
 
-    m_modelViewProjectionMatrix.setToIdentity();
-    m_modelViewProjectionMatrix.perspective(m_fov, (float)scaled_width()/scaled_height(), 0.1f, 100.0f);
-    m_modelViewProjectionMatrix *= m_viewMatrix * m_raycasting_volume->modelMatrix();
-
-    m_normalMatrix = (m_viewMatrix * m_raycasting_volume->modelMatrix()).normalMatrix();
-
-    m_rayOrigin = m_viewMatrix.inverted() * QVector3D({0.0, 0.0, 0.0});
+    // apply the TF edits made since the last frame
+    m_raycasting_volume->flush_tf_updates();
 
     // Perform raycasting
     m_modes[m_active_mode]();
+
+    // keep drawing until asynchronous uploads have been swapped in
+    if (m_raycasting_volume->uploads_pending()) {
+        update();
+    }
 }
 
 
@@ -151,38 +149,14 @@ GLuint RayCastCanvas::scaled_height()
  */
 void RayCastCanvas::raycasting(const QString& shader)
 {
-    m_shaders[shader]->bind();
-    {
-        m_shaders[shader]->setUniformValue("ViewMatrix", m_viewMatrix);
-        m_shaders[shader]->setUniformValue("ModelViewProjectionMatrix", m_modelViewProjectionMatrix);
-        m_shaders[shader]->setUniformValue("NormalMatrix", m_normalMatrix);
-        m_shaders[shader]->setUniformValue("aspect_ratio", m_aspectRatio);
-        m_shaders[shader]->setUniformValue("focal_length", m_focalLength);
-        m_shaders[shader]->setUniformValue("viewport_size", m_viewportSize);
-        m_shaders[shader]->setUniformValue("ray_origin", m_rayOrigin);
-        m_shaders[shader]->setUniformValue("top", m_raycasting_volume->top());
-        m_shaders[shader]->setUniformValue("bottom", m_raycasting_volume->bottom());
-        m_shaders[shader]->setUniformValue("background_colour", to_vector3d(m_background));
-        m_shaders[shader]->setUniformValue("material_colour", m_diffuseMaterial);
-        m_shaders[shader]->setUniformValue("step_length", m_stepLength);
-        m_shaders[shader]->setUniformValue("threshold", m_threshold);
-        m_shaders[shader]->setUniformValue("gamma", m_gamma);
-        m_shaders[shader]->setUniformValue("lighting_enabled", m_raycasting_volume->lighting_enabled);
-        m_shaders[shader]->setUniformValue("volume", 0);
-        m_shaders[shader]->setUniformValue("jitter", 1);
-        m_shaders[shader]->setUniformValue("color_proximity_tf", 2);
-        m_shaders[shader]->setUniformValue("space_proximity_tf", 3);
-        m_shaders[shader]->setUniformValue("segment_opacity_tf", 4);
-        m_shaders[shader]->setUniformValue("light_position_x", light_position_x);
-        m_shaders[shader]->setUniformValue("light_position_y", light_position_y);
-        m_shaders[shader]->setUniformValue("light_position_z", light_position_z);
-
-        glClearColor(m_background.redF(), m_background.greenF(), m_background.blueF(), m_background.alphaF());
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        m_raycasting_volume->paint();
-    }
-    m_shaders[shader]->release();
+    m_view.background = m_background;
+    m_view.material_colour = m_diffuseMaterial;
+    m_view.step_length = m_stepLength;
+    m_view.threshold = m_threshold;
+    m_view.gamma = m_gamma;
+    m_view.light_position = {light_position_x, light_position_y, light_position_z};
+
+    m_raycasting_volume->raycast(*m_shaders[shader], m_view);
 }
 
 
@@ -283,10 +257,8 @@ void RayCastCanvas::location_tf_add_side_to_polygon(int id, qreal x, qreal y)
     GLint viewport[4];
     glGetIntegerv(GL_VIEWPORT, viewport);
 
-    QMatrix4x4 qprojection;
-    qprojection.setToIdentity();
-    qprojection.perspective(m_fov, (float)scaled_width()/scaled_height(), 0.1f, 100.0f);
-    QMatrix4x4 qmodelview = m_viewMatrix * m_raycasting_volume->modelMatrix();
+    QMatrix4x4 qprojection = m_view.projection_matrix();
+    QMatrix4x4 qmodelview = m_view.view_matrix * m_raycasting_volume->modelMatrix();
     
     float* fmodelview = qmodelview.data();
     float* fprojection = qprojection.data();
@@ -323,13 +295,14 @@ void RayCastCanvas::location_tf_close_current_polygon(int id, qreal x, qreal y)
     polygon_creation_active = false;
     location_tf_add_side_to_polygon(id, x, y);
     // update transfer function
-    m_raycasting_volume->update_location_tf();
+    m_raycasting_volume->update_polygon_mask();
 }
 
 void RayCastCanvas::update_color_tf_opacity(int value, QString name)
 {
     std::string n = name.toStdString();
     int id = std::stoi(n.substr(12));          //opacity_bar_id
+    preview_tf_edit();
     m_raycasting_volume->update_color_proximity_tf_opacity(id, value);
     update();
 }
@@ -338,6 +311,7 @@ void RayCastCanvas::update_color_tf_size(int value, QString name)
 {
     std::string n = name.toStdString();
     int id = std::stoi(n.substr(10));          //color_bar_id
+    preview_tf_edit();
     m_raycasting_volume->update_color_proximity_tf_size(id, value);
     update();
 }
@@ -346,10 +320,77 @@ void RayCastCanvas::update_location_tf_opacity(int value, QString name)
 {
     std::string n = name.toStdString();
     int id = std::stoi(n.substr(12));          //opacity_bar_id
+    preview_tf_edit();
     m_raycasting_volume->update_location_proximity_tf_opacity(id, value);
     update();
 }
 
+void RayCastCanvas::update_polygon_depth_min(int value, QString name)
+{
+    std::string n = name.toStdString();
+    int id = std::stoi(n.substr(14));          //depth_min_bar_id
+    preview_tf_edit();
+    if (!m_raycasting_volume->update_polygon_depth_min(id, value))
+        reject_polygon_depth(value);
+    update();
+}
+
+void RayCastCanvas::update_polygon_depth_max(int value, QString name)
+{
+    std::string n = name.toStdString();
+    int id = std::stoi(n.substr(14));          //depth_max_bar_id
+    preview_tf_edit();
+    if (!m_raycasting_volume->update_polygon_depth_max(id, value))
+        reject_polygon_depth(value);
+    update();
+}
+
+/*!
+ * \brief Put the depth slider that sent the current signal back to \p value,
+ * when its new range would need more polygon mask layers than there are.
+ */
+void RayCastCanvas::reject_polygon_depth(int value)
+{
+    QSlider *bar = qobject_cast<QSlider*>(sender());
+    if (!bar)
+        return;
+    const QSignalBlocker blocker(bar);
+    bar->setValue(value);
+    QToolTip::showText(QCursor::pos(),
+                       tr("Polygons can use at most %1 different depth ranges.")
+                       .arg(RayCastVolume::MAX_POLYGON_MASK_LAYERS), bar);
+}
+
+/*!
+ * \brief A TF slider was pressed; edits are previewed until it is released.
+ */
+void RayCastCanvas::begin_tf_preview()
+{
+    m_tf_preview_held = true;
+}
+
+/*!
+ * \brief A TF slider was released; bake the edited TFs at full resolution.
+ */
+void RayCastCanvas::end_tf_preview()
+{
+    m_tf_preview_held = false;
+    m_tf_preview_idle.stop();
+    m_raycasting_volume->set_tf_preview(false);
+    update();
+}
+
+/*!
+ * \brief Switch to the low resolution TFs if the edit comes from a held slider.
+ */
+void RayCastCanvas::preview_tf_edit()
+{
+    if (!m_tf_preview_held)
+        return;
+    m_raycasting_volume->set_tf_preview(true);
+    m_tf_preview_idle.start();
+}
+
 void RayCastCanvas::update_slicing_plane_opacity(int value, QString name)
 {
     std::string n = name.toStdString();
@@ -374,6 +415,15 @@ void RayCastCanvas::update_slicing_plane_distance(int value, QString name)
     update();
 }
 
+void RayCastCanvas::update_slicing_plane_tilt(int value, QString name)
+{
+    std::string n = name.toStdString();
+    int axis = n[5] == 'u' ? 0 : 1;
+    int id = std::stoi(n.substr(10));          //tilt_u_bar_id, tilt_v_bar_id
+    m_raycasting_volume->update_slicing_plane_tilt(id, axis, value);
+    update();
+}
+
 void RayCastCanvas::update_slicing_plane_invert(QString name)
 {
     std::string n = name.toStdString();
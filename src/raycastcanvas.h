@@ -30,9 +30,11 @@
 #include <QOpenGLWidget>
 #include <QOpenGLExtraFunctions>
 #include <QOpenGLShaderProgram>
+#include <QTimer>
 
 #include "mesh.h"
 #include "polygon.h"
+#include "raycastview.h"
 #include "raycastvolume.h"
 #include "trackball.h"
 
@@ -53,6 +55,7 @@ public:
     }
 
     void setVolume(const QString& volume) {
+        makeCurrent();
         m_raycasting_volume->load_volume(volume);
         update();
     }
@@ -145,14 +148,35 @@ public:
         update();
     }
 
-    void set_space_proximity_tf(int id, qreal x, qreal y, bool left_mouse_pressed, bool right_mouse_pressed)
+    /*!
+     * \brief Add a side to the polygon being drawn, starting a new one if
+     * needed, or close it.
+     * \return Id of the polygon.
+     */
+    int set_space_proximity_tf(qreal x, qreal y, bool left_mouse_pressed, bool right_mouse_pressed)
     {
+        if (!polygon_creation_active && (left_mouse_pressed || right_mouse_pressed))
+            m_drawn_polygon_id = m_next_polygon_id++;
+        const int id = m_drawn_polygon_id;
         if (left_mouse_pressed)
             location_tf_add_side_to_polygon(id, x, y);
         else if(right_mouse_pressed)
             location_tf_close_current_polygon(id, x, y);
         update();
-
+        return id;
+    }
+    /*!
+     * \brief Add annotations to the location TF, with consecutive ids from
+     * \p first_id, which is set to an id no other polygon uses.
+     * \return Number of polygons added.
+     */
+    int import_annotations(const std::vector<Annotation>& annotations, int& first_id)
+    {
+        first_id = m_next_polygon_id;
+        const int added = m_raycasting_volume->add_annotations(annotations, first_id, 1.0f);
+        m_next_polygon_id += added;
+        update();
+        return added;
     }
     void set_color_proximity_tf(QRgb rgb, int id)
     {
@@ -163,7 +187,6 @@ public:
     void update_volume_opacity(int opacity)
     {
         m_raycasting_volume->update_volume_opacity(opacity);
-        m_raycasting_volume->update_location_tf();
         update();
     }
 
@@ -179,11 +202,23 @@ public:
         update();
     }
 
+    void enable_preclassification(bool value)
+    {
+        m_raycasting_volume->set_preclassification(value);
+        update();
+    }
+
+    void enable_preintegration(bool value)
+    {
+        m_raycasting_volume->set_preintegration(value);
+        update();
+    }
+
     void set_vram(int value) { m_raycasting_volume->set_vram(value); }
     void update_light_position_x(int value){ light_position_x = value; update(); }
     void update_light_position_y(int value){ light_position_y = value; update(); }
     void update_light_position_z(int value){ light_position_z = value; update(); }
-    void add_new_slicing_plane(int id) {m_raycasting_volume->add_new_slicing_plane(id); update(); }
+    bool add_new_slicing_plane(int id) { const bool added = m_raycasting_volume->add_new_slicing_plane(id); update(); return added; }
 
 signals:
     // NOPE
@@ -196,10 +231,15 @@ public slots:
     void update_color_tf_opacity(int value, QString name);
     void update_color_tf_size(int value, QString name);
     void update_location_tf_opacity(int value, QString name);
+    void update_polygon_depth_min(int value, QString name);
+    void update_polygon_depth_max(int value, QString name);
     void update_slicing_plane_opacity(int value, QString name);
     void update_slicing_plane_orientation(int value, QString name);
     void update_slicing_plane_distance(int value, QString name);
+    void update_slicing_plane_tilt(int value, QString name);
     void update_slicing_plane_invert(QString name);
+    void begin_tf_preview();
+    void end_tf_preview();
 
 protected:
     void initializeGL();
@@ -208,17 +248,10 @@ protected:
 
 private:
 
-    QMatrix4x4 m_viewMatrix;
-    QMatrix4x4 m_modelViewProjectionMatrix;
-    QMatrix3x3 m_normalMatrix;
-    float light_position_x=0.0, light_position_y=0.0, light_position_z=0.0; 
-
-    const GLfloat m_fov = 60.0f;                                          /*!< Vertical field of view. */
-    const GLfloat m_focalLength = 1.0 / qTan(M_PI / 180.0 * m_fov / 2.0); /*!< Focal length. */
-    GLfloat m_aspectRatio;                                                /*!< width / height */
+    void reject_polygon_depth(int value);
 
-    QVector2D m_viewportSize;
-    QVector3D m_rayOrigin; /*!< Camera position in model space coordinates. */
+    RayCastView m_view;     /*!< Camera of the last frame, and the parameters it was drawn with. */
+    float light_position_x=0.0, light_position_y=0.0, light_position_z=0.0; 
 
     QVector3D m_lightPosition {3.0, 0.0, 3.0};    /*!< In camera coordinates. */
     QVector3D m_diffuseMaterial {1.0, 1.0, 1.0};  /*!< Material colour. */
@@ -250,8 +283,17 @@ private:
     void create_noise(void);
     void add_shader(const QString& name, const QString& vector, const QString& fragment);
 
+    // TF edits made while a TF slider is held are previewed at low resolution,
+    // until it is released or stops moving for TF_PREVIEW_IDLE_MS
+    const int TF_PREVIEW_IDLE_MS = 300;
+    bool m_tf_preview_held = false;
+    QTimer m_tf_preview_idle;
+    void preview_tf_edit();
+
     // location/polygon TF related data
     bool polygon_creation_active = false;
+    int m_next_polygon_id = 0;      /*!< Id of the next polygon, drawn or imported. */
+    int m_drawn_polygon_id = 0;     /*!< Id of the polygon being drawn. */
     void location_tf_close_current_polygon(int id, qreal x, qreal y);
     void location_tf_add_side_to_polygon(int id, qreal x, qreal y);
     
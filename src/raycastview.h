@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cmath>
+
+#include <QColor>
+#include <QMatrix4x4>
+#include <QQuaternion>
+#include <QVector2D>
+#include <QVector3D>
+#include <QtMath>
+
+/*!
+ * \brief Camera and shading parameters for one raycasting pass.
+ *
+ * Filled in by whoever owns the viewport, the interactive canvas or the
+ * headless renderer, and handed to RayCastVolume::raycast(), so that both
+ * draw the same frame from the same parameters.
+ */
+struct RayCastView
+{
+    constexpr static float FOV = 60.0f;         /*!< Vertical field of view, in degrees. */
+
+    QMatrix4x4 view_matrix;
+    QMatrix4x4 model_view_projection_matrix;
+    QMatrix3x3 normal_matrix;
+    QVector3D ray_origin;                       /*!< Camera position in model space coordinates. */
+    float aspect_ratio {1.0f};                  /*!< width / height */
+    float focal_length {1.0f / (float) qTan(M_PI / 180.0 * FOV / 2.0)};
+    QVector2D viewport_size;
+
+    QColor background {Qt::black};
+    QVector3D material_colour {1.0, 1.0, 1.0};
+    float step_length {0.01f};                  /*!< Step length for ray march. */
+    float threshold {0.0f};                     /*!< Isosurface intensity threshold. */
+    float gamma {2.2f};                         /*!< Gamma correction parameter. */
+    QVector3D light_position;
+
+    /*!
+     * \brief Look at the volume from a distance, turned by \p rotation.
+     * \param dist_exp Zoom, as in the canvas' mouse wheel steps; 0 sits the
+     * camera 4 units away, and each 600 steps scale that by e.
+     */
+    void set_camera(const QQuaternion& rotation, float dist_exp, const QMatrix4x4& model_matrix,
+                    int width, int height)
+    {
+        view_matrix.setToIdentity();
+        view_matrix.translate(0, 0, -4.0f * std::exp(dist_exp / 600.0f));
+        view_matrix.rotate(rotation);
+
+        aspect_ratio = (float) width / height;
+        viewport_size = {(float) width, (float) height};
+
+        model_view_projection_matrix = projection_matrix();
+        model_view_projection_matrix *= view_matrix * model_matrix;
+
+        normal_matrix = (view_matrix * model_matrix).normalMatrix();
+
+        ray_origin = view_matrix.inverted() * QVector3D({0.0, 0.0, 0.0});
+    }
+
+    QMatrix4x4 projection_matrix() const
+    {
+        QMatrix4x4 projection;
+        projection.perspective(FOV, aspect_ratio, 0.1f, 100.0f);
+        return projection;
+    }
+};
@@ -38,10 +38,7 @@ float eucl_dist(int a, int b, int c, int x, int y, int z)
  * \brief Create a two-unit cube mesh as the bounding box for the volume.
  */
 RayCastVolume::RayCastVolume(void)
-    : m_volume_texture {0}
-    , m_noise_texture {0}
-    , m_tf_texture {0}
-    , m_segment_opacity_texture {0}
+    : m_noise_texture {0}
     , m_cube_vao {
           {
               -1.0f, -1.0f,  1.0f,
@@ -76,6 +73,13 @@ RayCastVolume::RayCastVolume(void)
       }
 {
     initializeOpenGLFunctions();
+
+    if (TFCompute::enabled())
+    {
+        m_tf_compute = std::make_unique<TFCompute>();
+        if (!m_tf_compute->valid())
+            m_tf_compute.reset();
+    }
 }
 
 
@@ -102,65 +106,28 @@ void RayCastVolume::load_volume(const QString& filename) {
 
     const std::string extension {match.captured(1).toLower().toStdString()};
     if ("tiff" == extension || "svs" == extension || "tif" == extension) {
-        uint32_t* data;
-        volume  = new OSVolume({filename.toStdString()});
+        m_shared_volume = SharedVolume::acquire(filename.toStdString());
+        m_shared_volume->texture();
+        m_volume_generation = m_shared_volume->generation();
+        volume = m_shared_volume->volume;
 
-        data = volume->data();
         m_spacing = QVector3D(0.5f,0.5f, 0.5f);
         m_origin = QVector3D(0.0f, 0.0f, 0.0f);
         m_size = volume->size();
         m_scaling = m_size;
 
-        initialize_texture_data();
-
-        glDeleteTextures(1, &m_volume_texture);
-        glGenTextures(1, &m_volume_texture);
-        glBindTexture(GL_TEXTURE_3D, m_volume_texture);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, m_size.x(),m_size.y(),m_size.z(),0,GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, data);
-        glGenerateMipmap(GL_TEXTURE_3D);
-        glBindTexture(GL_TEXTURE_3D, 0);
-
-
-        glDeleteTextures(1, &m_tf_texture);
-        glGenTextures(1, &m_tf_texture);
-        glBindTexture(GL_TEXTURE_3D, m_tf_texture);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        // TODO: recheck if interpolation is needed
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexImage3D(GL_TEXTURE_3D, 0, GL_RED, COLOR_TF_DIMENSION, COLOR_TF_DIMENSION, COLOR_TF_DIMENSION, 0, GL_RED,  GL_FLOAT, color_proximity_tf);
-        glBindTexture(GL_TEXTURE_3D, 0);
-
-        glDeleteTextures(1, &m_location_tf_texture);
-        glGenTextures(1, &m_location_tf_texture);
-        glBindTexture(GL_TEXTURE_3D, m_location_tf_texture);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        // TODO: recheck if interpolation is needed
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexImage3D(GL_TEXTURE_3D, 0, GL_RED, LOCATION_TF_DIMENSION, LOCATION_TF_DIMENSION, LOCATION_TF_DIMENSION, 0, GL_RED,  GL_FLOAT, location_tf);
-        glBindTexture(GL_TEXTURE_3D, 0);
-
-        for(int i = 0; i < 3; i++)
+        resize_polygon_mask();
+
+        // colour and location TFs are only created once something is added to them
+        update_color_proximity_tf_data();
+        update_polygon_mask();
+
+        // a new slide starts with every segment fully opaque
+        for(int i = 0; i < MAX_NUM_SEGMENTS; i++)
         {
             segment_opacity_tf[i] = 1.0f;
         }
-        glDeleteTextures(1, &m_segment_opacity_texture);
-        glGenTextures(1, &m_segment_opacity_texture);
-        glBindTexture(GL_TEXTURE_1D, m_segment_opacity_texture);
-        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexImage1D(GL_TEXTURE_1D, 0, GL_RED, MAX_NUM_SEGMENTS, 0, GL_RED, GL_FLOAT, segment_opacity_tf);
-        glBindTexture(GL_TEXTURE_1D, 0);
+        m_opacity_volume_tf_key_stale = true;
 
         /*
         uint32_t* tf = (uint32_t*)malloc(256);
@@ -193,10 +160,11 @@ void RayCastVolume::create_noise(void)
     const int height = viewport[3];
 
     std::srand(std::time(NULL));
-    unsigned char noise[width * height];
+    // on the heap, as large offscreen frames would overflow the stack
+    std::vector<unsigned char> noise(width * height);
 
-    for (unsigned char *p = noise; p <= noise + width * height; ++p) {
-        *p = std::rand() % 256;
+    for (unsigned char& p : noise) {
+        p = std::rand() % 256;
     }
 
     glDeleteTextures(1, &m_noise_texture);
@@ -206,7 +174,7 @@ void RayCastVolume::create_noise(void)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, noise);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, noise.data());
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
@@ -216,16 +184,151 @@ void RayCastVolume::create_noise(void)
  */
 void RayCastVolume::paint(void)
 {
-    glActiveTexture(GL_TEXTURE0); glBindTexture(GL_TEXTURE_3D, m_volume_texture);
+    GLuint volume_texture = 0;
+    if (m_shared_volume) {
+        volume_texture = m_shared_volume->texture();
+        // a new region has been swapped in, possibly requested by another view
+        if (m_volume_generation != m_shared_volume->generation()) {
+            m_volume_generation = m_shared_volume->generation();
+            m_scaling = m_shared_volume->size();
+            resize_polygon_mask();
+            place_annotations();
+        }
+    }
+
+    glActiveTexture(GL_TEXTURE0); glBindTexture(GL_TEXTURE_3D, volume_texture);
     glActiveTexture(GL_TEXTURE1); glBindTexture(GL_TEXTURE_2D, m_noise_texture);
-    glActiveTexture(GL_TEXTURE2); glBindTexture(GL_TEXTURE_3D, m_tf_texture);
-    glActiveTexture(GL_TEXTURE3); glBindTexture(GL_TEXTURE_3D, m_location_tf_texture);
-    glActiveTexture(GL_TEXTURE4); glBindTexture(GL_TEXTURE_1D, m_segment_opacity_texture);
+    glActiveTexture(GL_TEXTURE2); glBindTexture(GL_TEXTURE_3D, m_color_tf_texture.texture());
+    glActiveTexture(GL_TEXTURE3); glBindTexture(GL_TEXTURE_3D, m_opacity_volume_texture.texture());
+    glActiveTexture(GL_TEXTURE4); glBindTexture(GL_TEXTURE_2D, m_preintegrated_tf_texture.texture());
+    glActiveTexture(GL_TEXTURE5); glBindTexture(GL_TEXTURE_2D_ARRAY, m_polygon_mask_texture.texture());
 
     m_cube_vao.paint();
 }
 
 
+/*!
+ * \brief Raycast the volume with \p shader, from the camera in \p view.
+ *
+ * Clears the bound framebuffer to the background first.
+ */
+void RayCastVolume::raycast(QOpenGLShaderProgram& shader, const RayCastView& view)
+{
+    shader.bind();
+    {
+        shader.setUniformValue("ViewMatrix", view.view_matrix);
+        shader.setUniformValue("ModelViewProjectionMatrix", view.model_view_projection_matrix);
+        shader.setUniformValue("NormalMatrix", view.normal_matrix);
+        shader.setUniformValue("aspect_ratio", view.aspect_ratio);
+        shader.setUniformValue("focal_length", view.focal_length);
+        shader.setUniformValue("viewport_size", view.viewport_size);
+        shader.setUniformValue("ray_origin", view.ray_origin);
+        shader.setUniformValue("top", top());
+        shader.setUniformValue("bottom", bottom());
+        shader.setUniformValue("background_colour", QVector3D(view.background.redF(), view.background.greenF(), view.background.blueF()));
+        shader.setUniformValue("material_colour", view.material_colour);
+        shader.setUniformValue("step_length", view.step_length);
+        shader.setUniformValue("threshold", view.threshold);
+        shader.setUniformValue("gamma", view.gamma);
+        shader.setUniformValue("lighting_enabled", lighting_enabled);
+        shader.setUniformValue("volume", 0);
+        shader.setUniformValue("volume_offset", volume_offset());
+        shader.setUniformValue("volume_scale", volume_scale());
+        shader.setUniformValue("volume_texture_size", volume_texture_size());
+        shader.setUniformValue("volume_max_lod", volume_max_lod());
+        shader.setUniformValue("jitter", 1);
+        shader.setUniformValue("color_proximity_tf", 2);
+        shader.setUniformValue("opacity_volume", 3);
+        shader.setUniformValue("preclassified", preclassified());
+        shader.setUniformValue("preintegrated_tf", 4);
+        shader.setUniformValue("preintegrated", preintegrated());
+        shader.setUniformValue("opacity_correction", view.step_length / REFERENCE_STEP_LENGTH);
+        shader.setUniformValue("polygon_mask", 5);
+        shader.setUniformValue("color_tf_enabled", color_tf_enabled());
+        shader.setUniformValue("volume_opacity", get_volume_opacity());
+
+        GLfloat opacities[MAX_NUM_SEGMENTS];
+        const int segment_count = segment_opacities(opacities);
+        shader.setUniformValueArray("segment_opacities", opacities, segment_count, 1);
+
+        QVector4D planes[MAX_SLICING_PLANES];
+        GLfloat plane_opacities[MAX_SLICING_PLANES];
+        const int plane_count = slicing_plane_equations(planes, plane_opacities);
+        shader.setUniformValue("slicing_plane_count", plane_count);
+        if (plane_count > 0) {
+            shader.setUniformValueArray("slicing_planes", planes, plane_count);
+            shader.setUniformValueArray("slicing_plane_opacities", plane_opacities, plane_count, 1);
+        }
+
+        QVector2D mask_depths[MAX_POLYGON_MASK_LAYERS];
+        const int mask_layers = polygon_mask_layers(mask_depths);
+        shader.setUniformValue("polygon_mask_layers", mask_layers);
+        if (mask_layers > 0) {
+            shader.setUniformValueArray("polygon_mask_depths", mask_depths, mask_layers);
+        }
+
+        QVector4D spheres[MAX_ANALYTIC_COLOR_TFS];
+        GLfloat sphere_opacities[MAX_ANALYTIC_COLOR_TFS];
+        const int sphere_count = analytic_color_tfs(spheres, sphere_opacities);
+        shader.setUniformValue("color_tf_count", sphere_count);
+        if (sphere_count > 0) {
+            shader.setUniformValueArray("color_tf_spheres", spheres, sphere_count);
+            shader.setUniformValueArray("color_tf_opacities", sphere_opacities, sphere_count, 1);
+        }
+
+        shader.setUniformValue("light_position_x", view.light_position.x());
+        shader.setUniformValue("light_position_y", view.light_position.y());
+        shader.setUniformValue("light_position_z", view.light_position.z());
+
+        glClearColor(view.background.redF(), view.background.greenF(), view.background.blueF(), view.background.alphaF());
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        paint();
+    }
+    shader.release();
+}
+
+
+/*!
+ * \brief Copy of the volume and of every TF, for the CPU raycaster.
+ *
+ * Takes the most recent region, which is the one on screen once
+ * uploads_pending() is false. Without a volume loaded the pixels are left
+ * empty, and CPURayCaster refuses the copy.
+ */
+CPURayCastVolume RayCastVolume::cpu_volume()
+{
+    static_assert(CPURayCastVolume::MAX_NUM_SEGMENTS == MAX_NUM_SEGMENTS, "segment TFs differ in size");
+    CPURayCastVolume cpu;
+    if (m_shared_volume)
+    {
+        cpu.pixels = std::make_shared<const std::vector<uint32_t>>(m_shared_volume->latest_pixels());
+        cpu.layout = m_shared_volume->latest_layout();
+        cpu.levels = m_shared_volume->levels();
+    }
+    cpu.top = top();
+    cpu.bottom = bottom();
+
+    segment_opacities(cpu.segment_opacities);
+    // every pick is evaluated exactly, however many there are
+    for(const ColorTF &tf : color_tf_data)
+    {
+        const float radius = std::max(0, tf.proximity_radius);
+        cpu.color_tfs.push_back(QVector4D(qRed(tf.rgb), qGreen(tf.rgb), qBlue(tf.rgb), radius*radius));
+        cpu.color_tf_opacities.push_back(tf.opacity);
+    }
+    cpu.location_tfs = volume_classifier();
+    cpu.location_tfs.color_tfs.clear();
+
+    cpu.lighting = lighting_enabled;
+    cpu.preintegrated = m_preintegration;
+    if (cpu.preintegrated)
+        cpu.preintegrated_tf = preintegrated_tf_table();
+    cpu.reference_step_length = REFERENCE_STEP_LENGTH;
+    return cpu;
+}
+
+
 /*!
  * \brief Range of the image, in intensity value.
  * \return A pair, holding <minimum, maximum>.
@@ -257,40 +360,8 @@ uint32_t RayCastVolume::rgb(int x, int y, int z, int size)
 
 void RayCastVolume::update_volume_texture()
 {
-    m_scaling = volume->size();
-    // this causes a blank screen somehow weird!;
-    //glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_3D, m_volume_texture);
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, m_scaling.x(),m_scaling.y(),m_scaling.z(),0,GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, volume->data());
-    glGenerateMipmap(GL_TEXTURE_3D);
-    glBindTexture(GL_TEXTURE_3D, 0);
-}
-
-void RayCastVolume::update_location_tf_texture()
-{
-    // this causes a blank screen somehow weird!;
-    //glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_3D, m_location_tf_texture);
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_RED, LOCATION_TF_DIMENSION, LOCATION_TF_DIMENSION, LOCATION_TF_DIMENSION, 0, GL_RED,  GL_FLOAT, location_tf);
-    glBindTexture(GL_TEXTURE_3D, 0);
-}
-
-void RayCastVolume::update_segment_opacity_texture()
-{
-    // this causes a blank screen somehow weird!;
-    // glActiveTexture(GL_TEXTURE4);
-    glBindTexture(GL_TEXTURE_1D, m_segment_opacity_texture);
-    glTexImage1D(GL_TEXTURE_1D, 0, GL_RED, MAX_NUM_SEGMENTS, 0, GL_RED, GL_FLOAT, segment_opacity_tf);
-    glBindTexture(GL_TEXTURE_1D, 0);
-}
-
-void RayCastVolume::update_color_prox_texture()
-{
-    // this causes a blank screen somehow weird!;
-    //glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_3D, m_tf_texture);
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_RED, COLOR_TF_DIMENSION, COLOR_TF_DIMENSION, COLOR_TF_DIMENSION, 0, GL_RED,  GL_FLOAT, color_proximity_tf);
-    glBindTexture(GL_TEXTURE_3D, 0);
+    // the scaling follows once the new region reaches the screen, see paint()
+    m_shared_volume->update_texture();
 }
 
 /*
@@ -339,38 +410,636 @@ void RayCastVolume::set_location_tf()
 */
 
 
+/*!
+ * \brief Request a rebuild of the whole colour proximity TF at the next
+ * flush_tf_updates().
+ */
 void RayCastVolume::update_color_proximity_tf_data()
 {
-    
-    int red,green,blue;
-    
-    for(int i = 0; i < 256; i++)
+    m_color_tf_stale = true;
+    m_opacity_volume_tf_key_stale = true;
+}
+
+/*!
+ * \brief Request a rebuild of a box of the colour proximity TF at the next
+ * flush_tf_updates().
+ *
+ * Boxes requested between two flushes are merged, so a stream of edits costs
+ * a single rebuild.
+ */
+void RayCastVolume::update_color_proximity_tf_data(const TFBox& box)
+{
+    m_color_tf_dirty = m_color_tf_dirty.united(box);
+    m_opacity_volume_tf_key_stale = true;
+}
+
+/*!
+ * \brief Request a rebuild of the whole polygon mask at the next flush_tf_updates().
+ */
+void RayCastVolume::update_polygon_mask()
+{
+    m_polygon_mask_stale = true;
+    m_polygon_mask_key_stale = true;
+    m_opacity_volume_tf_key_stale = true;
+}
+
+/*!
+ * \brief Size the polygon mask after the visible region, so that its
+ * resolution rises as the view zooms in.
+ *
+ * The mask does not need more texels than the region has, up to
+ * POLYGON_MASK_DIMENSION on each axis. A new size rebuilds the whole mask,
+ * which also gives it a new cache key.
+ */
+void RayCastVolume::resize_polygon_mask()
+{
+    const int width = std::clamp((int) m_scaling.x(), 1, POLYGON_MASK_DIMENSION);
+    const int height = std::clamp((int) m_scaling.y(), 1, POLYGON_MASK_DIMENSION);
+    if (width == polygon_mask_width && height == polygon_mask_height)
+        return;
+    polygon_mask_width = width;
+    polygon_mask_height = height;
+    update_polygon_mask();
+}
+
+/*!
+ * \brief Request a rebuild of a box of the polygon mask at the next flush_tf_updates().
+ */
+void RayCastVolume::update_polygon_mask(const TFBox& box)
+{
+    m_polygon_mask_dirty = m_polygon_mask_dirty.united(box);
+    m_polygon_mask_key_stale = true;
+    m_opacity_volume_tf_key_stale = true;
+}
+
+/*!
+ * \brief Bake TFs at reduced resolution, while they are being edited.
+ *
+ * Edits made while previewing are baked as a whole at a fraction of the full
+ * size, which is cheap enough to follow a slider. Leaving the preview rebakes
+ * the TFs it touched at full resolution.
+ */
+void RayCastVolume::set_tf_preview(bool preview)
+{
+    if (preview == m_tf_preview)
+        return;
+    m_tf_preview = preview;
+    if (preview)
+        return;
+
+    m_color_tf_stale = m_color_tf_stale || m_color_tf_previewed;
+    m_polygon_mask_stale = m_polygon_mask_stale || m_polygon_mask_previewed;
+    m_color_tf_previewed = false;
+    m_polygon_mask_previewed = false;
+}
+
+/*!
+ * \brief Size of the polygon mask to bake, reduced while previewing.
+ */
+void RayCastVolume::polygon_mask_size(int& width, int& height)
+{
+    width = polygon_mask_width;
+    height = polygon_mask_height;
+    if (m_tf_preview)
+    {
+        width = std::min(width, POLYGON_MASK_PREVIEW_DIMENSION);
+        height = std::min(height, POLYGON_MASK_PREVIEW_DIMENSION);
+    }
+}
+
+/*!
+ * \brief Apply the TF edits recorded since the last call.
+ *
+ * Called once per frame, before the TF uniforms are read, with the GL
+ * context current. Edits only record the latest parameters and the cells
+ * they affect, so however many slider ticks arrive between two frames, each
+ * TF is rebuilt at most once.
+ *
+ * Rebuilds run on the TF workers; the results they have finished since the
+ * last frame are uploaded here, and the previous TFs are drawn until then.
+ */
+void RayCastVolume::flush_tf_updates()
+{
+    // a TF the GPU baked is cached at the first frame without a colour TF
+    // edit, as the worker's results are below
+    const bool color_tf_edited = m_color_tf_stale || !m_color_tf_dirty.empty();
+    flush_color_tf();
+    if (!color_tf_edited && !m_tf_preview)
+        m_tf_cache.store_deferred();
+    flush_deferred_color_tf();
+    flush_polygon_mask();
+    flush_opacity_volume();
+    flush_preintegrated_tf();
+
+    m_color_tf_worker.collect([this](const ColorTFBuffer& tf, const TFBox& box) {
+        // the size only changes with a rebuild of the whole TF
+        const int n = tf.dimension;
+        const TFBox all {0, 0, 0, n, n, n};
+        if (!m_color_tf_texture.valid() || box.contains(all))
+        {
+            m_color_tf_texture.upload(GL_R8, n, n, n, GL_RED, GL_UNSIGNED_BYTE, tf.cells.data());
+        }
+        else
+        {
+            const TFBox b = box.intersected(all);
+            m_color_tf_texture.update(0, b.x0, b.y0, b.z0, b.x1 - b.x0, b.y1 - b.y0, b.z1 - b.z0,
+                                      GL_RED, GL_UNSIGNED_BYTE,
+                                      &tf.cells[((size_t) b.z0*n + b.y0)*n + b.x0], n, n);
+        }
+        if (!tf.sparse && box.contains(m_color_tf_deferred))
+            m_color_tf_deferred = TFBox {0, 0, 0, 0, 0, 0};
+        // only complete TFs are cached, once edits have settled: the states
+        // a slider passes through would only push useful entries out
+        if (n == COLOR_TF_DIMENSION && m_color_tf_deferred.empty()
+                && !m_tf_preview && !m_color_tf_worker.pending())
+            m_tf_cache.store(tf.key, m_color_tf_texture, GL_TEXTURE_3D, GL_R8, n, n, n, tf.cells.size());
+    });
+
+    m_polygon_mask_worker.collect([this](const PolygonMask& mask, const TFBox& box) {
+        const int w = mask.width;
+        const int h = mask.height;
+        const TFBox all {0, 0, 0, w, h, (int) mask.depths.size()};
+        // the layout only changes with a rebuild of the whole mask
+        if (!m_polygon_mask_texture.valid() || box.contains(all))
+        {
+            m_polygon_mask_texture.upload(GL_RG8, w, h, all.z1, GL_RG, GL_UNSIGNED_BYTE, mask.texels.data());
+        }
+        else
+        {
+            const TFBox b = box.intersected(all);
+            m_polygon_mask_texture.update(0, b.x0, b.y0, b.z0, b.x1 - b.x0, b.y1 - b.y0, b.z1 - b.z0,
+                                          GL_RG, GL_UNSIGNED_BYTE,
+                                          &mask.texels[2*(((size_t) b.z0*h + b.y0)*w + b.x0)], w, h);
+        }
+        polygon_mask_depths = mask.depths;
+        // as above, once edits have settled
+        if (w == polygon_mask_width && h == polygon_mask_height
+                && !m_tf_preview && !m_polygon_mask_worker.pending())
+            m_tf_cache.store(mask.key, m_polygon_mask_texture, GL_TEXTURE_2D_ARRAY, GL_RG8,
+                             w, h, all.z1, mask.texels.size());
+    });
+
+    m_opacity_volume_worker.collect([this](const OpacityVolume& volume, const TFBox&) {
+        const RingLayout& l = volume.layout;
+        m_opacity_volume_texture.upload(GL_R8, l.texture_width, l.texture_height, l.depth,
+                                        GL_RED, GL_UNSIGNED_BYTE, volume.voxels.data());
+        m_opacity_volume_key = volume.key;
+        m_opacity_volume_generation = volume.generation;
+    });
+}
+
+/*!
+ * \brief Apply every TF to the volume on the CPU, so that the shader samples
+ * the opacity of each voxel instead of evaluating the TFs.
+ *
+ * While enabled, each TF edit, and each new region, reclassifies the whole
+ * volume on a worker, into an 8 bit opacity volume the size of the volume's
+ * ring buffer. Until it is uploaded the shader evaluates the TFs as usual.
+ */
+void RayCastVolume::set_preclassification(bool enabled)
+{
+    m_preclassification = enabled;
+    if (!enabled)
+    {
+        m_opacity_volume_worker.cancel();
+        m_opacity_volume_requested = m_opacity_volume_key;
+        m_classified_pixels.reset();
+    }
+}
+
+/*!
+ * \brief Whether the shader is to sample the opacity volume: it is enabled,
+ * and the drawn opacity volume matches the current TFs and region.
+ */
+bool RayCastVolume::preclassified()
+{
+    return m_preclassification && m_shared_volume
+            && m_opacity_volume_texture.valid() && !m_opacity_volume_texture.pending()
+            && m_opacity_volume_key == m_opacity_volume_requested
+            && m_opacity_volume_generation == m_shared_volume->generation();
+}
+
+/*!
+ * \brief Queue a classification of the volume if the TFs or the region have
+ * changed since the last one.
+ */
+void RayCastVolume::flush_opacity_volume()
+{
+    if (!m_preclassification || !m_shared_volume)
+        return;
+    // polygons added since the last mask rebuild have no layer yet
+    if (polygon_mask_layer.size() != polygons.size() && !polygons.empty())
+        return;
+
+    const uint64_t key = opacity_volume_key();
+    if (key == m_opacity_volume_requested)
+        return;
+    m_opacity_volume_requested = key;
+    if (key == m_opacity_volume_key)
+    {
+        // back to the TFs already uploaded
+        m_opacity_volume_worker.cancel();
+        return;
+    }
+
+    const RingLayout layout = m_shared_volume->latest_layout();
+    const unsigned int generation = m_shared_volume->latest_generation();
+    if (layout.texture_width < 1 || layout.texture_height < 1 || layout.depth < 1)
+        return;
+    // the slice is copied once per region, not per edit
+    if (!m_classified_pixels || m_classified_pixels_generation != generation)
+    {
+        m_classified_pixels = std::make_shared<const std::vector<uint32_t>>(m_shared_volume->latest_pixels());
+        m_classified_pixels_generation = generation;
+    }
+
+    const TFBox all {0, 0, 0, layout.texture_width, layout.texture_height, layout.depth};
+    m_opacity_volume_worker.submit(all, [tfs = volume_classifier(), pixels = m_classified_pixels,
+                                         layout, key, generation](
+            OpacityVolume& volume, const TFBox& box, const std::atomic<bool>& cancelled) mutable {
+        volume.voxels.resize((size_t) layout.texture_width * layout.texture_height * layout.depth);
+        volume.layout = layout;
+        volume.key = key;
+        volume.generation = generation;
+        classify_volume(tfs, pixels->data(), layout, volume.voxels.data(), &cancelled);
+        return box;
+    });
+}
+
+/*!
+ * \brief Key of the opacity volume for the current TFs and region: a hash of
+ * every TF as classify_volume() applies it, and of the region.
+ *
+ * The TFs' part is only hashed again after an edit.
+ */
+uint64_t RayCastVolume::opacity_volume_key()
+{
+    if (m_opacity_volume_tf_key_stale)
     {
-        for(int j = 0; j < 256; j++)
+        const std::vector<ColorTFSphere> spheres = color_tf_spheres(color_tf_data, COLOR_TF_DIMENSION);
+        float segments[256];
+        segment_opacity_table(segments);
+        QVector4D equations[MAX_SLICING_PLANES];
+        GLfloat opacities[MAX_SLICING_PLANES];
+        const int planes = slicing_plane_equations(equations, opacities);
+
+        const char tag[] = "opacity volume";
+        uint64_t key = hash_bytes(tag, sizeof(tag));
+        key = hash_bytes(spheres.data(), spheres.size() * sizeof(ColorTFSphere), key);
+        key = hash_bytes(segments, sizeof(segments), key);
+        key = hash_bytes(equations, planes * sizeof(QVector4D), key);
+        key = hash_bytes(opacities, planes * sizeof(GLfloat), key);
+        key = hash_bytes(&volume_opacity, sizeof(volume_opacity), key);
+        if (!polygons.empty())
         {
-            for(int k = 0; k < 256; k++)
-            {
-                // re-initialize the whole array to deal with deletes
-                color_proximity_tf[k][j][i] = 1.0f;
+            const uint64_t mask = polygon_mask_key();
+            key = hash_bytes(&mask, sizeof(mask), key);
+        }
+        m_opacity_volume_tf_key = key;
+        m_opacity_volume_tf_key_stale = false;
+    }
 
-                for(int l = 0; l < color_tf_data.size(); l++)
-                {
-                    red = qRed(color_tf_data[l].rgb);
-                    green = qGreen(color_tf_data[l].rgb);
-                    blue = qBlue(color_tf_data[l].rgb);
+    const RingLayout layout = m_shared_volume->latest_layout();
+    const unsigned int generation = m_shared_volume->latest_generation();
+    uint64_t key = hash_bytes(&layout, sizeof(layout), m_opacity_volume_tf_key);
+    return hash_bytes(&generation, sizeof(generation), key);
+}
 
-                    if (eucl_dist(i,j,k,red,green,blue)<= color_tf_data[l].proximity_radius)
-                    {
-                        color_proximity_tf[k][j][i] *= color_tf_data[l].opacity;
-                    }
+/*!
+ * \brief Opacity of each material id, as the shader's segment TF gives it.
+ * \param table Output, 256 entries indexed by the volume alpha.
+ */
+void RayCastVolume::segment_opacity_table(float *table)
+{
+    for(int a = 0; a < 256; a++)
+        table[a] = segment_opacity(a / 255.0f);
+}
+
+/*!
+ * \brief Opacity given by the segment TF to a material id in [0, 1], as
+ * segment_tf() in the shader evaluates it.
+ */
+float RayCastVolume::segment_opacity(float material)
+{
+    const float seg_id = (256.0f - material * 256.0f) / MAX_NUM_SEGMENTS;
+    const float u = seg_id * MAX_NUM_SEGMENTS - 0.5f;
+    const int i = std::floor(u);
+    const float f = u - std::floor(u);
+    const float lo = segment_opacity_tf[std::clamp(i, 0, MAX_NUM_SEGMENTS - 1)];
+    const float hi = segment_opacity_tf[std::clamp(i + 1, 0, MAX_NUM_SEGMENTS - 1)];
+    return lo + (hi - lo) * f;
+}
 
-                }
+/*!
+ * \brief Bake the pre-integrated segment TF if pre-integration is enabled
+ * and the segment opacities have changed since the last bake.
+ *
+ * The table is indexed by the material ids at both ends of a ray segment.
+ * It is small enough to bake on the GL thread, in parallel, when the TF
+ * changes.
+ */
+void RayCastVolume::flush_preintegrated_tf()
+{
+    if (!m_preintegration)
+        return;
+    const char tag[] = "preintegrated tf";
+    const uint64_t key = hash_bytes(segment_opacity_tf, sizeof(segment_opacity_tf), hash_bytes(tag, sizeof(tag)));
+    if (key == m_preintegrated_tf_key && m_preintegrated_tf_texture.valid())
+        return;
+
+    const std::vector<float> table = preintegrated_tf_table();
+    m_preintegrated_tf_texture.upload(GL_R32F, PREINTEGRATED_TF_DIMENSION, PREINTEGRATED_TF_DIMENSION, 1,
+                                      GL_RED, GL_FLOAT, table.data());
+    m_preintegrated_tf_key = key;
+}
 
-            }
+/*!
+ * \brief Bake the pre-integrated segment TF for the current segment opacities.
+ */
+std::vector<float> RayCastVolume::preintegrated_tf_table()
+{
+    const int n = PREINTEGRATED_TF_DIMENSION;
+    const int samples = (n - 1) * PREINTEGRATION_SUBDIVISIONS + 1;
+    std::vector<float> opacities(samples);
+    for(int k = 0; k < samples; k++)
+        opacities[k] = segment_opacity(k / (float) (samples - 1));
+    std::vector<float> table((size_t) n * n);
+    bake_preintegrated_tf(opacities.data(), n, PREINTEGRATION_SUBDIVISIONS, table.data());
+    return table;
+}
+
+/*!
+ * \brief Copy of every TF, for classify_volume().
+ */
+VolumeClassifier RayCastVolume::volume_classifier()
+{
+    VolumeClassifier tfs;
+    tfs.color_tfs = color_tf_spheres(color_tf_data, COLOR_TF_DIMENSION);
+    segment_opacity_table(tfs.segment_opacities);
+    if (!polygons.empty())
+    {
+        tfs.polygons = polygons;
+        tfs.polygon_layers = polygon_mask_layer;
+        tfs.layer_depths = polygon_mask_layer_depths;
+    }
+    tfs.mask_width = polygon_mask_width;
+    tfs.mask_height = polygon_mask_height;
+
+    QVector4D equations[MAX_SLICING_PLANES];
+    GLfloat opacities[MAX_SLICING_PLANES];
+    const int planes = slicing_plane_equations(equations, opacities);
+    tfs.planes.assign(equations, equations + planes);
+    tfs.plane_opacities.assign(opacities, opacities + planes);
+    tfs.volume_opacity = volume_opacity;
+    return tfs;
+}
+
+/*!
+ * \brief Rebuild the colour proximity TF if it was edited, or restore it from
+ * the cache if it was baked before.
+ */
+void RayCastVolume::flush_color_tf()
+{
+    // while the picks are evaluated in the shader the baked TF is not kept
+    // up to date, so it is rebuilt as a whole once it is needed again
+    if (color_tf_analytic())
+    {
+        m_color_tf_stale = true;
+        m_color_tf_dirty = TFBox {0, 0, 0, 0, 0, 0};
+        return;
+    }
+    if (!m_color_tf_stale && m_color_tf_dirty.empty())
+        return;
+
+    if (!m_tf_preview && !color_tf_data.empty() && m_tf_cache.restore(color_tf_key(), m_color_tf_texture))
+    {
+        // the worker's buffer, and any bake left to cache, no longer match
+        // the texture
+        m_color_tf_worker.cancel();
+        m_tf_cache.cancel_deferred();
+        m_color_tf_restored = true;
+        m_color_tf_deferred = TFBox {0, 0, 0, 0, 0, 0};
+    }
+    else if (m_color_tf_stale || m_tf_preview || m_color_tf_restored)
+    {
+        // previews are cheap enough to be baked as a whole
+        rebuild_color_tf();
+        m_color_tf_restored = false;
+    }
+    else
+    {
+        rebuild_color_tf(m_color_tf_dirty);
+    }
+    m_color_tf_stale = false;
+    m_color_tf_dirty = TFBox {0, 0, 0, 0, 0, 0};
+}
+
+/*!
+ * \brief Bake the cells that bakes limited to the colours present in the
+ * volume have skipped, once the worker is idle and no preview is running.
+ */
+void RayCastVolume::flush_deferred_color_tf()
+{
+    if (m_color_tf_deferred.empty() || m_tf_preview || m_color_tf_worker.busy())
+        return;
+    // the picks are evaluated in the shader, the TF is rebuilt once needed
+    if (color_tf_data.empty() || color_tf_analytic())
+    {
+        m_color_tf_deferred = TFBox {0, 0, 0, 0, 0, 0};
+        return;
+    }
+    rebuild_color_tf(m_color_tf_deferred, false);
+}
+
+/*!
+ * \brief Rebuild the polygon mask if it was edited, or restore it from the
+ * cache if it was baked before.
+ */
+void RayCastVolume::flush_polygon_mask()
+{
+    if (!m_polygon_mask_stale && m_polygon_mask_dirty.empty())
+        return;
+
+    if (!m_tf_preview && !polygons.empty())
+    {
+        if (m_polygon_mask_stale)
+            assign_polygon_mask_layers();
+        if (m_tf_cache.restore(polygon_mask_key(), m_polygon_mask_texture))
+        {
+            m_polygon_mask_worker.cancel();
+            m_polygon_mask_restored = true;
+            polygon_mask_depths = polygon_mask_layer_depths;
+            m_polygon_mask_stale = false;
+            m_polygon_mask_dirty = TFBox {0, 0, 0, 0, 0, 0};
+            return;
+        }
+    }
+
+    if (m_polygon_mask_stale || m_tf_preview || m_polygon_mask_restored)
+    {
+        rebuild_polygon_mask();
+        m_polygon_mask_restored = false;
+    }
+    else
+    {
+        rebuild_polygon_mask(m_polygon_mask_dirty);
+    }
+    m_polygon_mask_stale = false;
+    m_polygon_mask_dirty = TFBox {0, 0, 0, 0, 0, 0};
+}
+
+/*!
+ * \brief Cache key of the full resolution colour proximity TF: a hash of the
+ * picks as they are baked.
+ */
+uint64_t RayCastVolume::color_tf_key()
+{
+    const int n = COLOR_TF_DIMENSION;
+    const std::vector<ColorTFSphere> spheres = color_tf_spheres(color_tf_data, n);
+    const char tag[] = "colour";
+    uint64_t key = hash_bytes(tag, sizeof(tag));
+    key = hash_bytes(&n, sizeof(n), key);
+    return hash_bytes(spheres.data(), spheres.size() * sizeof(ColorTFSphere), key);
+}
+
+/*!
+ * \brief Cache key of the full resolution polygon mask: a hash of its size,
+ * its layers, and the polygons in each. Only hashed again after an edit.
+ */
+uint64_t RayCastVolume::polygon_mask_key()
+{
+    if (!m_polygon_mask_key_stale)
+        return m_polygon_mask_key;
+
+    std::vector<float> values {(float) polygon_mask_width, (float) polygon_mask_height};
+    for(const QVector2D &depth : polygon_mask_layer_depths)
+    {
+        values.push_back(depth.x());
+        values.push_back(depth.y());
+    }
+    for(int i = 0; i < polygons.size(); i++)
+    {
+        const std::vector<QVector3D> &vertices = polygons[i].get_vertices();
+        values.push_back(polygon_mask_layer[i]);
+        values.push_back(polygons[i].get_opacity());
+        values.push_back(vertices.size());
+        for(const QVector3D &v : vertices)
+        {
+            values.push_back(v.x());
+            values.push_back(v.y());
+        }
+    }
+    const char tag[] = "polygon mask";
+    m_polygon_mask_key = hash_bytes(values.data(), values.size() * sizeof(float), hash_bytes(tag, sizeof(tag)));
+    m_polygon_mask_key_stale = false;
+    return m_polygon_mask_key;
+}
+
+/*!
+ * \brief Queue a bake of the whole colour proximity TF.
+ */
+void RayCastVolume::rebuild_color_tf()
+{
+    const int n = color_tf_dimension();
+    rebuild_color_tf(TFBox {0, 0, 0, n, n, n});
+}
+
+/*!
+ * \brief Queue a bake of a box of the colour proximity TF.
+ * \param box Cells covered by the picks that changed, before and after the change.
+ * \param sparse Whether to only bake the colours present in the volume, and
+ * defer the rest of the box.
+ *
+ * The worker bakes from a copy of the picks, so later edits do not race with it.
+ */
+void RayCastVolume::rebuild_color_tf(const TFBox& box, bool sparse)
+{
+    // few picks are evaluated in the shader, nothing to bake
+    if (color_tf_data.empty() || color_tf_analytic() || box.empty())
+        return;
+    if (m_tf_preview)
+        m_color_tf_previewed = true;
+
+    const int n = color_tf_dimension();
+    const uint64_t key = color_tf_key();
+    if (m_tf_compute)
+    {
+        // baked in place on the GPU, nothing to upload; cached once edits
+        // have settled, previews not at all
+        m_tf_compute->bake_color_proximity_tf(color_tf_data, n, m_color_tf_texture, box);
+        if (n == COLOR_TF_DIMENSION)
+            m_tf_cache.defer_store(key, m_color_tf_texture, GL_TEXTURE_3D, GL_R8, n, n, n, (size_t) n*n*n);
+        else
+            m_tf_cache.cancel_deferred();
+        return;
+    }
+
+    // previews are small enough to bake whole
+    std::vector<uint8_t> occupied;
+    if (sparse && !m_tf_preview && occupied_bricks())
+    {
+        occupied = m_occupied_bricks;
+        m_color_tf_deferred = m_color_tf_deferred.united(box);
+    }
+
+    const std::vector<ColorTF> tfs = color_tf_data;
+    m_color_tf_worker.submit(box, [tfs, n, key, occupied](ColorTFBuffer& tf, const TFBox& box,
+                                                          const std::atomic<bool>& cancelled) {
+        // the first bake, and any at a new size, fills the whole TF
+        const TFBox all {0, 0, 0, n, n, n};
+        TFBox cells = box.intersected(all);
+        tf.sparse = !occupied.empty();
+        if (tf.dimension != n)
+        {
+            tf.cells.resize((size_t) n*n*n);
+            tf.dimension = n;
+            tf.sparse = false;
+            cells = all;
         }
+        tf.key = key;
+        bake_color_proximity_tf(tfs, n, tf.cells.data(), cells, &cancelled,
+                                tf.sparse ? occupied.data() : nullptr);
+        return cells;
+    });
+}
+
+/*!
+ * \brief Bricks of the colour cube present in the volume, or null if the
+ * volume has not been loaded.
+ */
+const uint8_t *RayCastVolume::occupied_bricks()
+{
+    if (!m_shared_volume)
+        return nullptr;
+    const ColorOccupancy& occupancy = m_shared_volume->occupancy();
+    if (m_occupied_bricks.empty() || m_occupied_bricks_version != occupancy.version())
+    {
+        m_occupied_bricks = occupancy.occupied_bricks();
+        m_occupied_bricks_version = occupancy.version();
     }
+    return m_occupied_bricks.data();
+}
+
+/*!
+ * \brief Parameters of the colour picks for the analytic colour TF.
+ * \param spheres Output, centre (0-255 colour units) and squared radius of
+ * each pick; room for MAX_ANALYTIC_COLOR_TFS entries.
+ * \param opacities Output, opacity of each pick.
+ * \return Number of picks, or 0 if the baked texture is used instead.
+ */
+int RayCastVolume::analytic_color_tfs(QVector4D *spheres, GLfloat *opacities)
+{
+    if (!color_tf_analytic())
+        return 0;
 
-    update_color_prox_texture();
+    for(int i = 0; i < (int) color_tf_data.size(); i++)
+    {
+        const ColorTF &tf = color_tf_data[i];
+        const float radius = std::max(0, tf.proximity_radius);
+        spheres[i] = QVector4D(qRed(tf.rgb), qGreen(tf.rgb), qBlue(tf.rgb), radius*radius);
+        opacities[i] = tf.opacity;
+    }
+    return color_tf_data.size();
 }
 
 void RayCastVolume::update_color_proximity_tf_opacity(int id, int opacity)
@@ -380,7 +1049,7 @@ void RayCastVolume::update_color_proximity_tf_opacity(int id, int opacity)
         if (color_tf_data[i].id == id)
         {
             color_tf_data[i].opacity = opacity/100.0;
-            update_color_proximity_tf_data();
+            update_color_proximity_tf_data(color_tf_footprint(color_tf_data[i], COLOR_TF_DIMENSION));
             break;
         }
     }
@@ -395,8 +1064,10 @@ void RayCastVolume::update_color_proximity_tf_size(int id, int size)
     {
         if (color_tf_data[i].id == id)
         {
+            TFBox box = color_tf_footprint(color_tf_data[i], COLOR_TF_DIMENSION);
             color_tf_data[i].proximity_radius = size;
-            update_color_proximity_tf_data();
+            box = box.united(color_tf_footprint(color_tf_data[i], COLOR_TF_DIMENSION));
+            update_color_proximity_tf_data(box);
             break;
         }
     }
@@ -406,138 +1077,342 @@ void RayCastVolume::set_color_proximity_tf_data(QRgb rgb, int id)
 {
     ColorTF new_tf = { id, rgb, COLOR_PROX_TF_DEFAULT_RADIUS, 0.0};
     color_tf_data.push_back(new_tf);
-    update_color_proximity_tf_data();
+    update_color_proximity_tf_data(color_tf_footprint(new_tf, COLOR_TF_DIMENSION));
 }
 
 void RayCastVolume::update_volume_opacity(int opacity)
 {
-   volume_opacity = opacity/100.0; 
-   update_location_tf();
+   // applied in the shader wherever no polygon or plane covers the volume
+   volume_opacity = opacity/100.0;
+   m_opacity_volume_tf_key_stale = true;
 }
 
 void RayCastVolume::update_segment_opacity(int id, int opacity)
 {
+    // a uniform, read by the shader on the next frame
     segment_opacity_tf[id] = opacity/100.0f;
-    update_segment_opacity_texture();
+    m_opacity_volume_tf_key_stale = true;
 }
 
-void RayCastVolume::update_location_tf_data()
+/*!
+ * \brief Opacity of each segment, evaluated in the shader.
+ * \param opacities Output, room for MAX_NUM_SEGMENTS entries.
+ * \return Number of segments.
+ */
+int RayCastVolume::segment_opacities(GLfloat *opacities)
+{
+    std::copy(segment_opacity_tf, segment_opacity_tf + MAX_NUM_SEGMENTS, opacities);
+    return MAX_NUM_SEGMENTS;
+}
+
+/*!
+ * \brief Plane equations of the slicing planes, evaluated in the shader.
+ * \param equations Output, normal and offset of each plane, such that it
+ * hides the points p where dot(normal, p) <= offset; room for
+ * MAX_SLICING_PLANES entries.
+ * \param opacities Output, opacity of each plane.
+ * \return Number of planes, at most MAX_SLICING_PLANES as add_new_slicing_plane()
+ * refuses any more.
+ */
+int RayCastVolume::slicing_plane_equations(QVector4D *equations, GLfloat *opacities)
+{
+    const int n = std::min((int) slicing_planes.size(), MAX_SLICING_PLANES);
+    for(int i = 0; i < n; i++)
+    {
+        equations[i] = slicing_planes[i].equation();
+        opacities[i] = slicing_planes[i].opacity;
+    }
+    return n;
+}
+
+/*!
+ * \brief Group polygons into mask layers by depth range.
+ *
+ * Polygons sharing a depth range share a layer. Once MAX_POLYGON_MASK_LAYERS
+ * ranges are in use, further polygons go to the last layer, whose range is
+ * widened to hold them.
+ */
+void RayCastVolume::assign_polygon_mask_layers()
 {
-    for(int i = 0; i < LOCATION_TF_DIMENSION; i++)
+    m_polygon_mask_key_stale = true;
+    m_opacity_volume_tf_key_stale = true;
+    std::vector<QVector2D> &depths = polygon_mask_layer_depths;
+    depths.clear();
+    polygon_mask_layer.assign(polygons.size(), 0);
+    for(int i = 0; i < polygons.size(); i++)
     {
-        for(int j = 0; j < LOCATION_TF_DIMENSION; j++)
+        const QVector2D depth(polygons[i].get_depth_min(), polygons[i].get_depth_max());
+        int layer = std::find(depths.begin(), depths.end(), depth) - depths.begin();
+        if (layer == (int) depths.size())
         {
-            for(int k = 0; k < LOCATION_TF_DIMENSION; k++)
+            if (layer < MAX_POLYGON_MASK_LAYERS)
+            {
+                depths.push_back(depth);
+            }
+            else
             {
-                location_tf[i][j][k] = volume_opacity;
+                if (layer == MAX_POLYGON_MASK_LAYERS)
+                    qWarning("More than %d polygon depth ranges; the last layer is widened to hold the rest",
+                             MAX_POLYGON_MASK_LAYERS);
+                layer = MAX_POLYGON_MASK_LAYERS - 1;
+                QVector2D &last = depths[layer];
+                last = QVector2D(std::min(last.x(), depth.x()), std::max(last.y(), depth.y()));
             }
         }
+        polygon_mask_layer[i] = layer;
     }
+}
 
+/*!
+ * \brief Queue a bake of the whole polygon mask.
+ */
+void RayCastVolume::rebuild_polygon_mask()
+{
+    if (polygons.empty())
+        return;
+
+    int w, h;
+    polygon_mask_size(w, h);
+    assign_polygon_mask_layers();
+    rebuild_polygon_mask(TFBox {0, 0, 0, w, h, (int) polygon_mask_layer_depths.size()});
 }
 
-void RayCastVolume::initialize_color_proximity_tf()
+/*!
+ * \brief Queue a bake of a box of the polygon mask.
+ * \param box Texels covered by the polygons that changed, before and after
+ * the change; z is the layer.
+ *
+ * The worker bakes from a copy of the polygons and of their layers. A new
+ * layout is baked as a whole, and replaces the mask texture once it is done.
+ */
+void RayCastVolume::rebuild_polygon_mask(const TFBox& box)
 {
-    for(int i = 0; i < COLOR_TF_DIMENSION; i++)
-    {
-        for(int j = 0; j < COLOR_TF_DIMENSION; j++)
+    if (polygons.empty() || box.empty())
+        return;
+    if (m_tf_preview)
+        m_polygon_mask_previewed = true;
+
+    int w, h;
+    polygon_mask_size(w, h);
+    const std::vector<QVector2D> depths = polygon_mask_layer_depths;
+    const std::vector<int> layers = polygon_mask_layer;
+    const uint64_t key = polygon_mask_key();
+    m_polygon_mask_worker.submit(box, [w, h, depths, layers, key, shapes = polygons](
+            PolygonMask& mask, const TFBox& box, const std::atomic<bool>& cancelled) mutable {
+        const TFBox all {0, 0, 0, w, h, (int) depths.size()};
+        TFBox texels = box.intersected(all);
+        if (mask.width != w || mask.height != h || mask.depths != depths)
         {
-            for(int k = 0; k < COLOR_TF_DIMENSION; k++)
-            {
-                color_proximity_tf[i][j][k] = 1.0f;
-            }
+            mask.texels.resize((size_t) 2*w*h*depths.size());
+            mask.width = w;
+            mask.height = h;
+            mask.depths = depths;
+            texels = all;
         }
-    }
+        mask.key = key;
+        bake_polygon_mask(shapes, layers, w, h, mask.texels.data(), texels, &cancelled);
+        return texels;
+    });
 }
 
-void RayCastVolume::initialize_texture_data()
+/*!
+ * \brief Texels of the polygon mask that a polygon may cover.
+ */
+TFBox RayCastVolume::polygon_mask_footprint(int index)
 {
-    update_location_tf_data();
+    const int w = polygon_mask_width;
+    const int h = polygon_mask_height;
+    // polygons added since the last rebuild have no layer yet, and are
+    // covered by the full rebuild that adding them requested
+    if (index >= (int) polygon_mask_layer.size())
+        return TFBox {0, 0, 0, 0, 0, 0};
+
+    const int layer = polygon_mask_layer[index];
+    float min_x, min_y, max_x, max_y;
+    if (!polygons[index].bounds(min_x, min_y, max_x, max_y))
+        return TFBox {0, 0, 0, 0, 0, 0};
+
+    // texels are sampled at their corner, i/w
+    return TFBox {std::clamp((int) std::floor(min_x*w), 0, w),
+                  std::clamp((int) std::floor(min_y*h), 0, h),
+                  layer,
+                  std::clamp((int) std::ceil(max_x*w) + 1, 0, w),
+                  std::clamp((int) std::ceil(max_y*h) + 1, 0, h),
+                  layer + 1};
+}
 
-    initialize_color_proximity_tf();
+/*!
+ * \brief Depth ranges of the polygon mask layers, in volume coordinates.
+ * \param depths Output, room for MAX_POLYGON_MASK_LAYERS entries.
+ * \return Number of layers, 0 if there is no mask to sample.
+ */
+int RayCastVolume::polygon_mask_layers(QVector2D *depths)
+{
+    if (!m_polygon_mask_texture.valid())
+        return 0;
 
-    for(int i = 0; i < MAX_NUM_SEGMENTS; i++)
-    {
-        segment_opacity_tf[i] = 1.0f;
-    }
+    std::copy(polygon_mask_depths.begin(), polygon_mask_depths.end(), depths);
+    return polygon_mask_depths.size();
+}
 
+/*!
+ * \brief Add imported annotations to the location TF as polygons.
+ * \param annotations Outlines, in pixels of the slide's full resolution level.
+ * \param first_id Id of the first polygon; the others follow in order.
+ * \param opacity Opacity of every polygon.
+ * \return Number of polygons added.
+ *
+ * Outlines are kept in slide coordinates, and placed relative to the region
+ * shown, again each time it changes. The mask is rebuilt once for all of
+ * them, at the next flush_tf_updates().
+ */
+int RayCastVolume::add_annotations(const std::vector<Annotation>& annotations, int first_id, float opacity)
+{
+    if (!volume || annotations.empty())
+        return 0;
 
+    polygons.reserve(polygons.size() + annotations.size());
+    for (size_t i = 0; i < annotations.size(); i++)
+    {
+        Polygon polygon;
+        polygon.id = first_id + i;
+        polygon.set_slide_vertices(annotations[i].vertices);
+        polygon.set_opacity(opacity);
+        polygons.push_back(std::move(polygon));
+    }
+    place_annotations();
+    return annotations.size();
 }
 
-void RayCastVolume::update_location_tf()
+/*!
+ * \brief Place the imported polygons in the region shown.
+ *
+ * Called on import and whenever a new region is swapped in, e.g. after a
+ * pan, a zoom or a change of level. Outlines leaving the region keep their
+ * polygon, and cover nothing until it comes back into view.
+ */
+void RayCastVolume::place_annotations()
 {
-    if (polygons.size()==0 && slicing_planes.size()==0) 
+    if (!m_shared_volume)
+        return;
+    const OSVolume::Region r = m_shared_volume->region();
+    if (r.width <= 0 || r.height <= 0)
+        return;
+
+    const double downsample = volume->level_downsample(r.level);
+    bool placed = false;
+    for(Polygon &polygon : polygons)
     {
-        update_location_tf_texture(); return;
+        const std::vector<QPointF> &outline = polygon.get_slide_vertices();
+        if (outline.empty())
+            continue;
+        std::vector<QVector3D> vertices;
+        vertices.reserve(outline.size());
+        for (const QPointF& p : outline)
+            vertices.push_back(QVector3D((p.x()/downsample - r.x)/r.width,
+                                         (p.y()/downsample - r.y)/r.height,
+                                         0.5f));
+        polygon.set_vertices(polygon.id, std::move(vertices));
+        placed = true;
     }
+    if (placed)
+        update_polygon_mask();
+}
 
-    for(int i = 0; i < LOCATION_TF_DIMENSION; i++)
+void RayCastVolume::update_location_proximity_tf_opacity(int id, int opacity)
+{
+    for(int i = 0; i < polygons.size(); i++)
     {
-        for(int j =0; j < LOCATION_TF_DIMENSION; j++)
+        if (polygons[i].id == id)
         {
-            // re initialize
-            location_tf[0][j][i] = volume_opacity;
-            for(int k = 0; k < polygons.size(); k++)
-            {
-                if (polygons[k].point_is_inside(i/(float)LOCATION_TF_DIMENSION, j/(float)LOCATION_TF_DIMENSION))
-                {
-                    // replace opacity of full volume, else compose
-                    if (location_tf[0][j][i] == volume_opacity)
-                        location_tf[0][j][i] = polygons[k].get_opacity();
-                    else
-                        location_tf[0][j][i] = location_tf[0][j][i]*polygons[k].get_opacity();
-                }
-
-            }
+            polygons[i].set_opacity(opacity/100.0);
+            update_polygon_mask(polygon_mask_footprint(i));
+            break;
         }
     }
-    // duplicate z layer for now since TF can only be oriented parallel to volume
-    for(int i = 0; i < LOCATION_TF_DIMENSION; i++)
+}
+
+/*!
+ * \brief Whether the polygons' depth ranges fit in the mask layers, with
+ * the polygon at \p index given \p depth.
+ */
+bool RayCastVolume::polygon_depth_fits(int index, const QVector2D& depth)
+{
+    std::vector<QVector2D> depths {depth};
+    for(int i = 0; i < (int) polygons.size(); i++)
     {
-        for(int j =0; j < LOCATION_TF_DIMENSION; j++)
-        {
-            for(int k = 1; k < LOCATION_TF_DIMENSION; k++)
-            {
-                location_tf[k][j][i] = location_tf[0][j][i];
-            }
-        }
+        const QVector2D d(polygons[i].get_depth_min(), polygons[i].get_depth_max());
+        if (i != index && std::find(depths.begin(), depths.end(), d) == depths.end())
+            depths.push_back(d);
     }
+    return depths.size() <= (size_t) MAX_POLYGON_MASK_LAYERS;
+}
 
-    // crop slicing planes
-    for(int i = 0; i < LOCATION_TF_DIMENSION; i++)
+/*!
+ * \brief Move the near end of the depth range a polygon applies to.
+ * \param value Depth, in percent of the volume depth; set to the current
+ * depth if the move is refused.
+ * \return False if the new range would need more than
+ * MAX_POLYGON_MASK_LAYERS distinct depth ranges, in which case nothing changes.
+ */
+bool RayCastVolume::update_polygon_depth_min(int id, int& value)
+{
+    for(int i = 0; i < polygons.size(); i++)
     {
-        for(int j = 0; j < LOCATION_TF_DIMENSION; j++)
+        if (polygons[i].id == id)
         {
-            for(int k = 0; k < LOCATION_TF_DIMENSION; k++)
+            const QVector2D depth(value/100.0f, polygons[i].get_depth_max());
+            if (!polygon_depth_fits(i, depth))
             {
-                for(int l = 0; l < slicing_planes.size(); l++)
-                {
-                    if (slicing_planes[l].point_is_inside(i/(float)LOCATION_TF_DIMENSION, j/(float)LOCATION_TF_DIMENSION, k/(float)LOCATION_TF_DIMENSION))
-                    {
-                        if (location_tf[k][j][i] == volume_opacity)
-                            location_tf[k][j][i] = slicing_planes[l].opacity;
-                        else
-                            location_tf[k][j][i] *= slicing_planes[l].opacity;
-                    }
-                }
+                value = std::lround(polygons[i].get_depth_min() * 100.0f);
+                return false;
             }
+            polygons[i].set_depth_range(depth.x(), depth.y());
+            update_polygon_mask();
+            break;
         }
     }
-    update_location_tf_texture();
+    return true;
 }
 
-
-void RayCastVolume::update_location_proximity_tf_opacity(int id, int opacity)
+/*!
+ * \brief Move the far end of the depth range a polygon applies to.
+ * \param value Depth, in percent of the volume depth; set to the current
+ * depth if the move is refused.
+ * \return False if the new range would need more than
+ * MAX_POLYGON_MASK_LAYERS distinct depth ranges, in which case nothing changes.
+ */
+bool RayCastVolume::update_polygon_depth_max(int id, int& value)
 {
     for(int i = 0; i < polygons.size(); i++)
     {
         if (polygons[i].id == id)
         {
-            polygons[i].set_opacity(opacity/100.0);
-            update_location_tf();
+            const QVector2D depth(polygons[i].get_depth_min(), value/100.0f);
+            if (!polygon_depth_fits(i, depth))
+            {
+                value = std::lround(polygons[i].get_depth_max() * 100.0f);
+                return false;
+            }
+            polygons[i].set_depth_range(depth.x(), depth.y());
+            update_polygon_mask();
             break;
         }
     }
+    return true;
+}
+
+/*!
+ * \brief Add a slicing plane, unless there are MAX_SLICING_PLANES already.
+ * \return Whether the plane was added.
+ */
+bool RayCastVolume::add_new_slicing_plane(int id)
+{
+    if (slicing_planes.size() >= (size_t) MAX_SLICING_PLANES)
+        return false;
+    slicing_planes.push_back(Plane(id));
+    m_opacity_volume_tf_key_stale = true;
+    return true;
 }
 
 void RayCastVolume::update_slicing_plane_opacity(int id, int opacity)
@@ -547,7 +1422,7 @@ void RayCastVolume::update_slicing_plane_opacity(int id, int opacity)
         if (slicing_planes[i].id == id)
         {
             slicing_planes[i].opacity = opacity/100.0;
-            update_location_tf();
+            m_opacity_volume_tf_key_stale = true;
             break;
         }
     }
@@ -560,7 +1435,7 @@ void RayCastVolume::update_slicing_plane_orientation(int id, int value)
         if (slicing_planes[i].id == id)
         {
             slicing_planes[i].update_orientation(value);
-            update_location_tf();
+            m_opacity_volume_tf_key_stale = true;
             break;
         }
     }
@@ -573,7 +1448,25 @@ void RayCastVolume::update_slicing_plane_distance(int id, int value)
         if (slicing_planes[i].id == id)
         {
             slicing_planes[i].update_distance(value/100.0);
-            update_location_tf();
+            m_opacity_volume_tf_key_stale = true;
+            break;
+        }
+    }
+}
+
+/*!
+ * \brief Tilt a slicing plane.
+ * \param axis 0 or 1, for the first or second axis perpendicular to the plane's orientation.
+ * \param value Angle, in degrees.
+ */
+void RayCastVolume::update_slicing_plane_tilt(int id, int axis, int value)
+{
+    for(int i = 0; i < slicing_planes.size(); i++)
+    {
+        if (slicing_planes[i].id == id)
+        {
+            slicing_planes[i].update_tilt(axis, value*M_PI/180.0);
+            m_opacity_volume_tf_key_stale = true;
             break;
         }
     }
@@ -586,7 +1479,7 @@ void RayCastVolume::update_slicing_plane_invert(int id)
         if (slicing_planes[i].id == id)
         {
             slicing_planes[i].invert();
-            update_location_tf();
+            m_opacity_volume_tf_key_stale = true;
             break;
         }
     }
@@ -25,21 +25,28 @@
 
 #include <QMatrix4x4>
 #include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QVector2D>
 #include <QVector3D>
+#include <QVector4D>
 #include <QColor>
+#include <ctime>
+#include <memory>
 #include <vector>
 
+#include "annotations.h"
+#include "cpuraycaster.h"
 #include "mesh.h"
 #include "plane.h"
 #include "polygon.h"
 #include "osvolume.h"
-
-struct ColorTF {
-    int id;
-    QRgb rgb;
-    int proximity_radius;
-    float opacity;
-};
+#include "raycastview.h"
+#include "sharedvolume.h"
+#include "texturestream.h"
+#include "tfbaker.h"
+#include "tfcache.h"
+#include "tfcompute.h"
+#include "tfworker.h"
 
 /*!
  * \brief Class for a raycasting volume.
@@ -53,6 +60,8 @@ public:
     void load_volume(const QString &filename);
     void create_noise(void);
     void paint(void);
+    void raycast(QOpenGLShaderProgram& shader, const RayCastView& view);
+    CPURayCastVolume cpu_volume(void);
     std::pair<double, double> range(void);
 
 
@@ -185,40 +194,156 @@ public:
     {
         lighting_enabled = value;
     }
-    void set_vram(int value){volume->set_vram(value);}
+    void set_vram(int value)
+    {
+        volume->set_vram(value);
+        m_tf_cache.set_budget((size_t) value * 1024 * 1024 / TF_CACHE_VRAM_FRACTION);
+    }
 
-    void initialize_color_proximity_tf();
     void set_color_proximity_tf_data(QRgb rgb, int id);
     void update_color_proximity_tf_data();
+    void update_color_proximity_tf_data(const TFBox& box);
     void update_color_proximity_tf_opacity(int id, int opacity);
     void update_color_proximity_tf_size(int id, int size);
 
     void update_segment_opacity(int id, int opacity);
+
+    /*!
+     * \brief Number of segments (material ids) with their own opacity.
+     */
+    const static int MAX_NUM_SEGMENTS = 3;
+
+    int segment_opacities(GLfloat *opacities);
     void update_volume_opacity(int opacity);
 
     bool lighting_enabled = false;
 
-    void update_location_tf();
+    /*!
+     * \brief Number of colour picks up to which the shader evaluates the
+     * colour TF analytically instead of sampling the baked texture.
+     */
+    const static int MAX_ANALYTIC_COLOR_TFS = 16;
+
+    /*!
+     * \brief Whether the colour TF is evaluated in the shader from the picks.
+     */
+    bool color_tf_analytic() {
+        return !color_tf_data.empty() && color_tf_data.size() <= (size_t) MAX_ANALYTIC_COLOR_TFS;
+    }
+
+    /*!
+     * \brief Whether the baked colour proximity TF is to be sampled.
+     *
+     * When disabled, and no picks are evaluated analytically, the shader skips
+     * the colour TF entirely.
+     */
+    bool color_tf_enabled() { return !color_tf_analytic() && m_color_tf_texture.valid(); }
+
+    int analytic_color_tfs(QVector4D *spheres, GLfloat *opacities);
+
+    /*!
+     * \brief Number of slicing planes evaluated in the shader.
+     */
+    const static int MAX_SLICING_PLANES = 16;
+
+    int slicing_plane_equations(QVector4D *equations, GLfloat *opacities);
+
+    /*!
+     * \brief Number of depth ranges up to which polygons get their own mask layer.
+     */
+    const static int MAX_POLYGON_MASK_LAYERS = 8;
+
+    int polygon_mask_layers(QVector2D *depths);
+
+    float get_volume_opacity() { return volume_opacity; }
+
+    /*!
+     * \brief Offset of the visible region in the ring buffer volume texture.
+     */
+    QVector3D volume_offset() {
+        return m_shared_volume ? m_shared_volume->offset() : QVector3D(0.0f, 0.0f, 0.0f);
+    }
+
+    /*!
+     * \brief Extent of the visible region in the ring buffer volume texture.
+     */
+    QVector3D volume_scale() {
+        return m_shared_volume ? m_shared_volume->scale() : QVector3D(1.0f, 1.0f, 1.0f);
+    }
+
+    /*!
+     * \brief Size of the ring buffer volume texture, in texels of its base level.
+     */
+    QVector3D volume_texture_size() {
+        return m_shared_volume ? m_shared_volume->texture_size() : QVector3D(1.0f, 1.0f, 1.0f);
+    }
+
+    /*!
+     * \brief Coarsest mip level of the volume texture.
+     */
+    float volume_max_lod() {
+        return m_shared_volume ? m_shared_volume->levels() - 1 : 0.0f;
+    }
+
+    /*!
+     * \brief Whether a TF bake or a texture upload has yet to reach the
+     * screen, in which case the view should be repainted.
+     */
+    bool uploads_pending() {
+        return (m_shared_volume && m_shared_volume->pending())
+                || m_color_tf_texture.pending() || m_polygon_mask_texture.pending()
+                || m_color_tf_worker.busy() || m_polygon_mask_worker.busy()
+                || m_opacity_volume_texture.pending() || m_opacity_volume_worker.busy()
+                || m_preintegrated_tf_texture.pending() || m_polygon_mask_stale
+                || (!m_color_tf_deferred.empty() && !m_tf_preview);
+    }
+
+    void update_polygon_mask();
+    void update_polygon_mask(const TFBox& box);
+
+    void flush_tf_updates();
+    void set_tf_preview(bool preview);
+
+    void set_preclassification(bool enabled);
+    bool preclassified();
+
+    /*!
+     * \brief Integrate the segment TF between consecutive samples, and
+     * correct opacities for the step length, so that larger steps look alike.
+     */
+    void set_preintegration(bool enabled) { m_preintegration = enabled; }
+    bool preintegrated() { return m_preintegration && m_preintegrated_tf_texture.valid(); }
+
+    int add_annotations(const std::vector<Annotation>& annotations, int first_id, float opacity);
     void update_location_proximity_tf_opacity(int id, int opacity);
+    bool update_polygon_depth_min(int id, int& value);
+    bool update_polygon_depth_max(int id, int& value);
     void update_slicing_plane_opacity(int id, int opacity);
     void update_slicing_plane_orientation(int id, int value);
     void update_slicing_plane_distance(int id, int value);
     void update_slicing_plane_invert(int id);
+    void update_slicing_plane_tilt(int id, int axis, int value);
 
-    void add_new_slicing_plane(int id) { slicing_planes.push_back(Plane(id)); update_location_tf();}
+    bool add_new_slicing_plane(int id);
 
     std::vector<Polygon> polygons;
     std::vector<Plane> slicing_planes;
 
 private:
-    const static int MAX_NUM_SEGMENTS = 3;
-    const static int LOCATION_TF_DIMENSION = 256;
+    const static int POLYGON_MASK_DIMENSION = 1024; /*!< Upper bound for each polygon mask axis. */
     const static int COLOR_TF_DIMENSION = 256;
-    GLuint m_volume_texture;
+    const static int COLOR_TF_PREVIEW_DIMENSION = 64;       /*!< Colour TF size while previewing. */
+    const static int POLYGON_MASK_PREVIEW_DIMENSION = 256;  /*!< Polygon mask axis bound while previewing. */
+    const static int TF_CACHE_VRAM_FRACTION = 8;    /*!< Share of the VRAM budget for cached TFs. */
+    const static int PREINTEGRATION_SUBDIVISIONS = 16;  /*!< Segment TF samples per material level. */
+    const static int PREINTEGRATED_TF_DIMENSION = 256;  /*!< Material levels on each axis of the pre-integrated TF. */
+    constexpr static float REFERENCE_STEP_LENGTH = 0.01f;  /*!< Step length TF opacities are meant for, when pre-integrated. */
     GLuint m_noise_texture;
-    GLuint m_tf_texture;
-    GLuint m_location_tf_texture;
-    GLuint m_segment_opacity_texture;
+    // TF textures stay empty until their first upload
+    TextureStream m_color_tf_texture {GL_TEXTURE_3D, GL_LINEAR, GL_CLAMP_TO_EDGE};
+    TextureStream m_polygon_mask_texture {GL_TEXTURE_2D_ARRAY, GL_LINEAR, GL_CLAMP_TO_EDGE};
+    TextureStream m_opacity_volume_texture {GL_TEXTURE_3D, GL_LINEAR, GL_REPEAT};
+    TextureStream m_preintegrated_tf_texture {GL_TEXTURE_2D, GL_LINEAR, GL_CLAMP_TO_EDGE};
     Mesh m_cube_vao;
     std::pair<double, double> m_range;
     QVector3D m_origin;
@@ -228,10 +353,91 @@ private:
     float volume_opacity = 1.0;
 
 
+    // slide and volume texture, shared with other views of the same file
+    std::shared_ptr<SharedVolume> m_shared_volume;
+    unsigned int m_volume_generation = 0;
     OSVolume *volume;
 
-    float color_proximity_tf[COLOR_TF_DIMENSION][COLOR_TF_DIMENSION][COLOR_TF_DIMENSION];
-    float location_tf[LOCATION_TF_DIMENSION][LOCATION_TF_DIMENSION][LOCATION_TF_DIMENSION];
+    // TFs are baked on worker threads, into buffers that stay empty until
+    // the first pick or polygon is added. Opacities are stored as 8 bit fixed
+    // point, uploaded as GL_R8; the polygon mask pairs them with a coverage
+    // flag, uploaded as GL_RG8. Slicing planes need no texture, the shader
+    // evaluates them directly.
+    struct ColorTFBuffer {
+        std::vector<uint8_t> cells;
+        int dimension = 0;
+        uint64_t key = 0;               /*!< Cache key of the TF being baked. */
+        bool sparse = false;            /*!< The last bake skipped the colours absent from the volume. */
+    };
+    struct PolygonMask {
+        std::vector<uint8_t> texels;    /*!< Polygons, 2D with a layer per depth range. */
+        int width = 0, height = 0;
+        std::vector<QVector2D> depths;  /*!< Depth range of each layer. */
+        uint64_t key = 0;               /*!< Cache key of the mask being baked. */
+    };
+    // every TF applied to each voxel of the volume, uploaded as GL_R8 with
+    // the layout of the volume's ring buffer
+    struct OpacityVolume {
+        std::vector<uint8_t> voxels;
+        RingLayout layout;
+        uint64_t key = 0;               /*!< TFs and region it was classified for. */
+        unsigned int generation = 0;    /*!< Volume generation it was classified for. */
+    };
+    TFWorker<ColorTFBuffer> m_color_tf_worker;
+    TFWorker<PolygonMask> m_polygon_mask_worker;
+    TFWorker<OpacityVolume> m_opacity_volume_worker;
+    std::unique_ptr<TFCompute> m_tf_compute;   /*!< Bakes the colour TF on the GPU instead, if enabled. */
+
+    // full resolution TFs seen before; the budget follows set_vram(), from
+    // the same 4 GB default as OSVolume
+    TFCache m_tf_cache {(size_t) 4096 * 1024 * 1024 / TF_CACHE_VRAM_FRACTION};
+    bool m_color_tf_restored = false;       /*!< The texture came from the cache, not the worker. */
+
+    // colour TF cells skipped by bakes limited to the colours present in the
+    // volume, baked once the TF is no longer being edited
+    TFBox m_color_tf_deferred {0, 0, 0, 0, 0, 0};
+    std::vector<uint8_t> m_occupied_bricks;
+    unsigned int m_occupied_bricks_version = 0;
+    bool m_polygon_mask_restored = false;
+
+    int polygon_mask_width = 0, polygon_mask_height = 0;
+    std::vector<int> polygon_mask_layer;    /*!< Mask layer of each polygon, as last assigned. */
+    std::vector<QVector2D> polygon_mask_layer_depths;   /*!< Depth range of each layer, as last assigned. */
+    std::vector<QVector2D> polygon_mask_depths; /*!< Depth range of each layer of the uploaded mask. */
+
+    // TF edits waiting for flush_tf_updates(): whole TFs to rebuild, or the
+    // union of the boxes to recompute
+    bool m_color_tf_stale = false;
+    TFBox m_color_tf_dirty {0, 0, 0, 0, 0, 0};
+    bool m_polygon_mask_stale = false;
+    TFBox m_polygon_mask_dirty {0, 0, 0, 0, 0, 0};
+
+    // hashes of the polygon mask and of every TF the opacity volume applies,
+    // kept until an edit invalidates them, as they are needed every frame
+    uint64_t m_polygon_mask_key = 0;
+    bool m_polygon_mask_key_stale = true;
+    uint64_t m_opacity_volume_tf_key = 0;
+    bool m_opacity_volume_tf_key_stale = true;
+
+    // pre-classification: the key and volume generation of the uploaded
+    // opacity volume, the key of the latest classification requested, and
+    // the slice it reads, shared with the worker
+    bool m_preclassification = false;
+    uint64_t m_opacity_volume_key = 0;
+    unsigned int m_opacity_volume_generation = 0;
+    uint64_t m_opacity_volume_requested = 0;
+    std::shared_ptr<const std::vector<uint32_t>> m_classified_pixels;
+    unsigned int m_classified_pixels_generation = 0;
+
+    // pre-integration: the segment opacities the uploaded table was baked for
+    bool m_preintegration = false;
+    uint64_t m_preintegrated_tf_key = 0;
+
+    // while previewing, and whether the preview has changed each TF
+    bool m_tf_preview = false;
+    bool m_color_tf_previewed = false;
+    bool m_polygon_mask_previewed = false;
+
     float segment_opacity_tf[MAX_NUM_SEGMENTS];
     float COLOR_PROX_TF_DEFAULT_RADIUS = 1;
     float SPACE_PROX_TF_DEFAULT_RADIUS = 100;
@@ -239,12 +445,31 @@ private:
 
     float scale_factor(void);
     uint32_t rgb(int x, int y, int z, int size);
-    void initialize_texture_data();
-    void update_segment_opacity_texture();
     void update_volume_texture();
-    void update_location_tf_texture();
-    void update_location_tf_data();
-    void update_color_prox_texture();
+    void assign_polygon_mask_layers();
+    TFBox polygon_mask_footprint(int index);
+    int color_tf_dimension() { return m_tf_preview ? COLOR_TF_PREVIEW_DIMENSION : COLOR_TF_DIMENSION; }
+    void polygon_mask_size(int& width, int& height);
+    void resize_polygon_mask();
+    void place_annotations();
+    bool polygon_depth_fits(int index, const QVector2D& depth);
+    void flush_color_tf();
+    void flush_deferred_color_tf();
+    void flush_polygon_mask();
+    void flush_opacity_volume();
+    void flush_preintegrated_tf();
+    std::vector<float> preintegrated_tf_table();
+    uint64_t color_tf_key();
+    uint64_t polygon_mask_key();
+    uint64_t opacity_volume_key();
+    float segment_opacity(float material);
+    void segment_opacity_table(float *table);
+    VolumeClassifier volume_classifier();
+    void rebuild_color_tf();
+    void rebuild_color_tf(const TFBox& box, bool sparse = true);
+    const uint8_t *occupied_bricks();
+    void rebuild_polygon_mask();
+    void rebuild_polygon_mask(const TFBox& box);
     std::vector<ColorTF> color_tf_data;
 
 };
@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QSurfaceFormat>
+
+#include "cpuraycaster.h"
+#include "offscreenrenderer.h"
+#include "renderscene.h"
+
+/*!
+ * \brief Render a frame with the CPU raycaster.
+ * \param ms Output, time taken, in milliseconds.
+ */
+static QImage render_cpu(const CPURayCaster& caster, const RayCastView& view, int width, int height, double& ms)
+{
+    QImage image(width, height, QImage::Format_RGBA8888);
+    QElapsedTimer timer;
+    timer.start();
+    caster.render(view, width, height, image.bits());
+    ms = timer.nsecsElapsed() / 1e6;
+    // opaque, like OffscreenRenderer::image()
+    return image.convertToFormat(QImage::Format_RGBX8888);
+}
+
+/*!
+ * \brief Render the frames of a scene description to PNG files, without a
+ * window, and print how long each took to draw.
+ *
+ * With --cpu the frames are rendered by the CPU raycaster instead; with
+ * --compare by both, writing the GPU frames and checking them against the
+ * CPU ones. The exit status is 2 if a frame does not match.
+ */
+int main(int argc, char *argv[])
+{
+    QGuiApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Render a slide offscreen, from a scene description.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("scene", "JSON scene description.");
+    QCommandLineOption output_option({"o", "output"}, "Directory for the frames.", "directory", ".");
+    QCommandLineOption timeout_option("timeout", "Time allowed for TF bakes and uploads, in ms.", "ms", "60000");
+    QCommandLineOption cpu_option("cpu", "Render on the CPU instead of the GPU.");
+    QCommandLineOption compare_option("compare", "Render on both, and check the GPU frames against the CPU ones.");
+    QCommandLineOption tolerance_option("tolerance", "Largest difference per 8 bit channel to accept.", "value", "8");
+    QCommandLineOption exceeding_option("max-exceeding", "Share of the channels that may differ by more, in percent.",
+                                        "percent", "1");
+    parser.addOption(output_option);
+    parser.addOption(timeout_option);
+    parser.addOption(cpu_option);
+    parser.addOption(compare_option);
+    parser.addOption(tolerance_option);
+    parser.addOption(exceeding_option);
+    parser.process(a);
+    if (parser.positionalArguments().size() != 1) {
+        parser.showHelp(1);
+    }
+    const bool cpu = parser.isSet(cpu_option);
+    const bool compare = parser.isSet(compare_option);
+    const int tolerance = parser.value(tolerance_option).toInt();
+    const double max_exceeding = parser.value(exceeding_option).toDouble();
+
+    // the format of the interactive app
+    QSurfaceFormat format;
+    format.setDepthBufferSize(32);
+    format.setVersion(4, 6);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    format.setSamples(0);
+    QSurfaceFormat::setDefaultFormat(format);
+
+    bool matched = true;
+    try {
+        const RenderScene scene = load_render_scene(parser.positionalArguments()[0]);
+        const QDir output_dir(parser.value(output_option));
+        if (!output_dir.mkpath(".")) {
+            throw std::runtime_error("Cannot create " + output_dir.path().toStdString() + ".");
+        }
+
+        // the slide is loaded through GL even when rendering on the CPU
+        OffscreenRenderer renderer(scene.width, scene.height);
+        scene.apply(renderer.volume());
+
+        RayCastView view = scene.view;
+        std::printf(compare ? "frame,ms_min,ms_mean,cpu_ms,max_difference,mean_difference,exceeding\n"
+                            : "frame,ms_min,ms_mean\n");
+        for (const RenderFrame& frame : scene.frames) {
+            view.set_camera(frame.rotation, frame.zoom, renderer.volume().modelMatrix(),
+                            scene.width, scene.height);
+            if (!renderer.settle(view, parser.value(timeout_option).toInt())) {
+                throw std::runtime_error("Timed out waiting for TF bakes and uploads.");
+            }
+            // the region streamed in may have changed the volume's extent
+            view.set_camera(frame.rotation, frame.zoom, renderer.volume().modelMatrix(),
+                            scene.width, scene.height);
+
+            std::unique_ptr<CPURayCaster> caster;
+            if (cpu || compare) {
+                caster.reset(new CPURayCaster(renderer.volume().cpu_volume()));
+            }
+
+            QImage image;
+            double min = 0.0, total = 0.0;
+            for (int i = 0; i < scene.repeat; i++) {
+                double ms;
+                if (cpu) {
+                    image = render_cpu(*caster, view, scene.width, scene.height, ms);
+                } else {
+                    ms = renderer.draw(view);
+                }
+                min = i ? std::min(min, ms) : ms;
+                total += ms;
+            }
+            if (!cpu) {
+                image = renderer.image();
+            }
+
+            if (compare) {
+                double cpu_ms;
+                const QImage reference = render_cpu(*caster, view, scene.width, scene.height, cpu_ms);
+                const int64_t pixels = (int64_t) scene.width * scene.height;
+                const ImageDifference difference = compare_images(image.constBits(), reference.constBits(),
+                                                                  pixels, tolerance);
+                const double exceeding = 100.0 * difference.exceeding / (4 * pixels);
+                matched &= exceeding <= max_exceeding;
+                std::printf("%s,%.3f,%.3f,%.3f,%d,%.4f,%.4f\n", qPrintable(frame.output), min, total / scene.repeat,
+                            cpu_ms, difference.max, difference.mean, exceeding);
+            } else {
+                std::printf("%s,%.3f,%.3f\n", qPrintable(frame.output), min, total / scene.repeat);
+            }
+
+            const QString path = output_dir.filePath(frame.output);
+            if (!image.save(path)) {
+                throw std::runtime_error("Cannot write " + path.toStdString() + ".");
+            }
+        }
+    }
+    catch (std::runtime_error& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    if (!matched) {
+        std::fprintf(stderr, "Frames differ from the CPU reference by more than the tolerance.\n");
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include "renderscene.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "annotations.h"
+
+static QColor read_colour(const QJsonValue& value)
+{
+    const QColor colour(value.toString());
+    if (!colour.isValid())
+        throw std::runtime_error("Invalid colour \"" + value.toString().toStdString() + "\".");
+    return colour;
+}
+
+static QVector3D read_vector(const QJsonValue& value, const QVector3D& fallback)
+{
+    const QJsonArray xyz = value.toArray();
+    if (xyz.size() != 3)
+        return fallback;
+    return QVector3D(xyz[0].toDouble(), xyz[1].toDouble(), xyz[2].toDouble());
+}
+
+static int read_opacity(const QJsonValue& value, int fallback)
+{
+    const int opacity = value.toInt(fallback);
+    if (opacity < 0 || opacity > 100)
+        throw std::runtime_error("Opacities and distances range from 0 to 100.");
+    return opacity;
+}
+
+static QString frame_name(size_t index, const QString& prefix = "frame_")
+{
+    return QString("%1%2.png").arg(prefix).arg(index, 4, 10, QChar('0'));
+}
+
+/*!
+ * \brief Read a scene description.
+ * \param filename JSON file.
+ *
+ * Throws std::runtime_error if the file cannot be read, or describes no slide.
+ */
+RenderScene load_render_scene(const QString& filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+        throw std::runtime_error("Cannot open " + filename.toStdString() + ".");
+
+    QJsonParseError error;
+    const QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &error);
+    if (!document.isObject())
+        throw std::runtime_error("Invalid scene description: " + error.errorString().toStdString());
+    const QJsonObject json = document.object();
+
+    const QDir dir = QFileInfo(filename).dir();
+    auto path = [&dir](const QJsonValue& value) {
+        return value.isString() ? QDir::cleanPath(dir.absoluteFilePath(value.toString())) : QString();
+    };
+
+    RenderScene scene;
+    scene.slide = path(json["slide"]);
+    if (scene.slide.isEmpty())
+        throw std::runtime_error("The scene description names no slide.");
+    scene.width = json["width"].toInt(scene.width);
+    scene.height = json["height"].toInt(scene.height);
+    if (scene.width <= 0 || scene.height <= 0)
+        throw std::runtime_error("Invalid image size.");
+    scene.vram = json["vram"].toInt(scene.vram);
+    scene.best_resolution = json["best_resolution"].toBool(scene.best_resolution);
+
+    scene.view.step_length = json["step_length"].toDouble(scene.view.step_length);
+    if (scene.view.step_length <= 0.0f)
+        throw std::runtime_error("Invalid step length.");
+    if (json.contains("background"))
+        scene.view.background = read_colour(json["background"]);
+    scene.view.light_position = read_vector(json["light_position"], scene.view.light_position);
+
+    scene.lighting = json["lighting"].toBool(scene.lighting);
+    scene.preclassified = json["preclassified"].toBool(scene.preclassified);
+    scene.preintegrated = json["preintegrated"].toBool(scene.preintegrated);
+    scene.volume_opacity = read_opacity(json["volume_opacity"], scene.volume_opacity);
+
+    const QJsonArray segments = json["segment_opacities"].toArray();
+    if (segments.size() > RayCastVolume::MAX_NUM_SEGMENTS)
+        throw std::runtime_error("Too many segment opacities.");
+    for (const QJsonValue& opacity : segments)
+        scene.segment_opacities.push_back(read_opacity(opacity, 100));
+
+    for (const QJsonValue& value : json["color_tfs"].toArray())
+    {
+        const QJsonObject tf = value.toObject();
+        scene.color_tfs.push_back({read_colour(tf["colour"]).rgb(),
+                                   read_opacity(tf["opacity"], 100),
+                                   read_opacity(tf["distance"], 10)});
+    }
+
+    scene.annotations = path(json["annotations"]);
+    scene.repeat = std::max(json["repeat"].toInt(scene.repeat), 1);
+
+    for (const QJsonValue& value : json["frames"].toArray())
+    {
+        const QJsonObject frame = value.toObject();
+        scene.frames.push_back({QQuaternion::fromAxisAndAngle(read_vector(frame["axis"], {0, 1, 0}),
+                                                              frame["angle"].toDouble(0.0)),
+                                (float) frame["zoom"].toDouble(-200.0),
+                                frame["output"].toString(frame_name(scene.frames.size()))});
+    }
+
+    // a turn around the volume, in even steps
+    const QJsonObject orbit = json["orbit"].toObject();
+    const int orbit_frames = orbit["frames"].toInt(0);
+    for (int i = 0; i < orbit_frames; i++)
+    {
+        scene.frames.push_back({QQuaternion::fromAxisAndAngle(read_vector(orbit["axis"], {0, 1, 0}),
+                                                              360.0f * i / orbit_frames),
+                                (float) orbit["zoom"].toDouble(-200.0),
+                                frame_name(scene.frames.size(), orbit["output"].toString("frame_"))});
+    }
+
+    if (scene.frames.empty())
+        scene.frames.push_back({QQuaternion(), -200.0f, frame_name(0)});
+
+    return scene;
+}
+
+
+/*!
+ * \brief Load the slide into \p volume and set up its TFs.
+ */
+void RenderScene::apply(RayCastVolume& volume) const
+{
+    volume.load_volume(slide);
+    if (vram > 0)
+        volume.set_vram(vram);
+    if (best_resolution)
+        volume.load_best_res();
+
+    volume.enable_lighting(lighting);
+    volume.set_preclassification(preclassified);
+    volume.set_preintegration(preintegrated);
+    volume.update_volume_opacity(volume_opacity);
+    for (size_t i = 0; i < segment_opacities.size(); i++)
+        volume.update_segment_opacity(i, segment_opacities[i]);
+
+    for (size_t i = 0; i < color_tfs.size(); i++)
+    {
+        volume.set_color_proximity_tf_data(color_tfs[i].rgb, i);
+        volume.update_color_proximity_tf_opacity(i, color_tfs[i].opacity);
+        volume.update_color_proximity_tf_size(i, color_tfs[i].distance);
+    }
+
+    if (!annotations.isEmpty())
+        volume.add_annotations(load_annotations(annotations), 0, 1.0f);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vector>
+
+#include <QColor>
+#include <QQuaternion>
+#include <QString>
+
+#include "raycastview.h"
+#include "raycastvolume.h"
+
+/*!
+ * \brief A colour TF, as picked in the UI: slider values are 0-100.
+ */
+struct RenderColorTF {
+    QRgb rgb;
+    int opacity;
+    int distance;
+};
+
+/*!
+ * \brief One output image: a camera pose and the file it is written to.
+ */
+struct RenderFrame {
+    QQuaternion rotation;
+    float zoom;                     // mouse wheel steps, as RayCastView::set_camera() takes
+    QString output;
+};
+
+/*!
+ * \brief Slide, TFs and cameras for the headless renderer, read from a JSON
+ * description; see the README for the format.
+ *
+ * Opacities are 0-100, like the UI sliders. Relative paths of the slide and
+ * the annotations are resolved against the description's directory.
+ */
+struct RenderScene {
+    QString slide;
+    int width {1024};
+    int height {768};
+    int vram {0};                   // MB, 0 keeps the default budget
+    bool best_resolution {false};
+    RayCastView view;               // shading parameters; the camera is set per frame
+    bool lighting {false};
+    bool preclassified {false};
+    bool preintegrated {false};
+    int volume_opacity {100};
+    std::vector<int> segment_opacities;
+    std::vector<RenderColorTF> color_tfs;
+    QString annotations;
+    int repeat {1};                 // times each frame is drawn, for timing
+    std::vector<RenderFrame> frames;
+
+    void apply(RayCastVolume& volume) const;
+};
+
+RenderScene load_render_scene(const QString& filename);
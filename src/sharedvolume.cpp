@@ -0,0 +1,365 @@
+#include "sharedvolume.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+
+// upload throughput, off unless enabled with
+// QT_LOGGING_RULES="raycaster.volume.upload.debug=true"
+Q_LOGGING_CATEGORY(volume_upload_log, "raycaster.volume.upload", QtInfoMsg)
+
+std::map<std::string, std::weak_ptr<SharedVolume>> SharedVolume::s_volumes;
+
+
+/*!
+ * \brief Positive remainder, for wrap-around addressing.
+ */
+static int64_t wrap(int64_t value, int64_t size)
+{
+    return ((value % size) + size) % size;
+}
+
+
+/*!
+ * \brief Halve an RGBA8 image with a 2x2 box filter.
+ * \param width Width of \p src, even.
+ * \param height Height of \p src, even.
+ */
+static std::vector<uint32_t> reduce(const std::vector<uint32_t>& src, int64_t width, int64_t height)
+{
+    const int64_t w = width / 2;
+    const int64_t h = height / 2;
+    std::vector<uint32_t> dst(w * h);
+
+    #pragma omp parallel for
+    for (int64_t j = 0; j < h; j++) {
+        const uint8_t *row0 = reinterpret_cast<const uint8_t*>(&src[2 * j * width]);
+        const uint8_t *row1 = reinterpret_cast<const uint8_t*>(&src[(2 * j + 1) * width]);
+        uint8_t *out = reinterpret_cast<uint8_t*>(&dst[j * w]);
+        for (int64_t i = 0; i < 4 * w; i++) {
+            const int64_t c = i / 4 * 8 + i % 4;
+            out[i] = (row0[c] + row0[c + 4] + row1[c] + row1[c + 4] + 2) / 4;
+        }
+    }
+    return dst;
+}
+
+
+/*!
+ * \brief Get the shared volume for a file, opening it if no view holds it.
+ * \param filename Slide to be opened.
+ */
+std::shared_ptr<SharedVolume> SharedVolume::acquire(const std::string& filename)
+{
+    std::shared_ptr<SharedVolume> shared = s_volumes[filename].lock();
+    if (!shared) {
+        shared = std::shared_ptr<SharedVolume>(new SharedVolume(filename));
+        s_volumes[filename] = shared;
+    }
+    return shared;
+}
+
+/*!
+ * \brief Open the slide and upload its initial region.
+ *
+ * Requires a current OpenGL context.
+ */
+SharedVolume::SharedVolume(const std::string& filename)
+    : volume {new OSVolume(filename)}
+    , m_filename {filename}
+{
+    initializeOpenGLFunctions();
+    update_texture();
+}
+
+SharedVolume::~SharedVolume()
+{
+    s_volumes.erase(m_filename);
+    delete volume;
+}
+
+/*!
+ * \brief Upload the current region of the slide.
+ *
+ * A pan that keeps part of the previous region only uploads the newly exposed
+ * strips, in place. Any other change reallocates the ring and uploads it
+ * asynchronously; texture() keeps returning the previous region until the
+ * upload has completed.
+ */
+void SharedVolume::update_texture()
+{
+    const OSVolume::Region r = volume->region();
+    if (r.width < 1 || r.height < 1 || r.depth < 1) {
+        return;
+    }
+
+    const int64_t dx = r.x - m_ring.x;
+    const int64_t dy = r.y - m_ring.y;
+    const int64_t w = m_ring.texture_width;
+    const int64_t h = m_ring.texture_height;
+
+    QElapsedTimer timer;
+    timer.start();
+    int64_t texels = 0;
+
+    if (r.level == m_ring.level && r.width == m_ring.width && r.height == m_ring.height
+            && r.depth == m_ring.depth && !m_texture.pending()
+            && std::abs(dx) < w && std::abs(dy) < h) {
+        m_ring.x = r.x;
+        m_ring.y = r.y;
+        if (dx > 0) {
+            upload_rect(r.x + w - dx, r.y, dx, h, false);
+        }
+        else if (dx < 0) {
+            upload_rect(r.x, r.y, -dx, h, false);
+        }
+        if (dy > 0) {
+            upload_rect(r.x, r.y + h - dy, w, dy, false);
+        }
+        else if (dy < 0) {
+            upload_rect(r.x, r.y, w, -dy, false);
+        }
+        texels = (std::abs(dx) * h + std::abs(dy) * w) * r.depth;
+    }
+    else {
+        m_ring.level = r.level;
+        m_ring.x = r.x;
+        m_ring.y = r.y;
+        m_ring.width = r.width;
+        m_ring.height = r.height;
+        m_ring.depth = r.depth;
+        m_ring.texture_width = (r.width + RING_ALIGNMENT - 1) / RING_ALIGNMENT * RING_ALIGNMENT;
+        m_ring.texture_height = (r.height + RING_ALIGNMENT - 1) / RING_ALIGNMENT * RING_ALIGNMENT;
+        if (m_keep_ring_data) {
+            m_ring_data.assign(m_ring.texture_width * m_ring.texture_height, 0);
+        }
+        m_occupancy.clear();
+
+        m_texture.begin(GL_RGBA8, m_ring.texture_width, m_ring.texture_height, m_ring.depth, MIP_LEVELS);
+        upload_rect(r.x, r.y, m_ring.texture_width, m_ring.texture_height, true);
+        m_texture.end();
+        texels = m_ring.texture_width * m_ring.texture_height * m_ring.depth;
+    }
+    m_uploaded_generation++;
+
+    // decode, conversion and staging throughput, counting base level texels
+    // only; the copy to the texture itself is asynchronous and not included
+    if (volume_upload_log().isDebugEnabled()) {
+        const double ms = timer.nsecsElapsed() / 1e6;
+        const double mb = texels * sizeof(uint32_t) / (1024.0 * 1024.0);
+        qCDebug(volume_upload_log, "%.1f MB in %.1f ms (%.0f MB/s)", mb, ms, ms > 0 ? mb / ms * 1000.0 : 0.0);
+    }
+}
+
+/*!
+ * \brief Read a rectangle of the slide and store it at its wrapped position
+ * in every mip level of the ring.
+ * \param x Slide position, in pixels of the ring's level.
+ * \param full Whether this is part of a full upload, or an in-place update.
+ *
+ * The rectangle must not be larger than the ring. All slices of the volume
+ * are filled with the same image.
+ */
+void SharedVolume::upload_rect(int64_t x, int64_t y, int64_t width, int64_t height, bool full)
+{
+    // read a rectangle aligned to the coarsest mip, so that each level can be
+    // reduced from the one above it
+    const int64_t x0 = x / RING_ALIGNMENT * RING_ALIGNMENT;
+    const int64_t y0 = y / RING_ALIGNMENT * RING_ALIGNMENT;
+    int64_t w = (x + width - x0 + RING_ALIGNMENT - 1) / RING_ALIGNMENT * RING_ALIGNMENT;
+    int64_t h = (y + height - y0 + RING_ALIGNMENT - 1) / RING_ALIGNMENT * RING_ALIGNMENT;
+
+    std::vector<uint32_t> pixels(w * h);
+    volume->read_region(m_ring.level, x0, y0, w, h, pixels.data());
+    m_occupancy.add(pixels.data(), pixels.size());
+    if (m_keep_ring_data) {
+        store_ring_data(x, y, width, height, &pixels[(y - y0) * w + (x - x0)], w);
+    }
+    upload_mip(0, x, y, width, height, &pixels[(y - y0) * w + (x - x0)], w, full);
+
+    for (int level = 1; level < MIP_LEVELS; level++) {
+        const int pyramid_level = volume->matching_level(m_ring.level, 1 << level);
+        if (pyramid_level >= 0) {
+            w /= 2;
+            h /= 2;
+            pixels.resize(w * h);
+            volume->read_region(pyramid_level, x0 >> level, y0 >> level, w, h, pixels.data());
+        }
+        else {
+            pixels = reduce(pixels, w, h);
+            w /= 2;
+            h /= 2;
+        }
+        m_occupancy.add(pixels.data(), pixels.size());
+
+        // texels touched by the rectangle, at most the whole ring
+        const int64_t mx = x >> level;
+        const int64_t my = y >> level;
+        const int64_t mw = std::min(((x + width + (1 << level) - 1) >> level) - mx, m_ring.texture_width >> level);
+        const int64_t mh = std::min(((y + height + (1 << level) - 1) >> level) - my, m_ring.texture_height >> level);
+        upload_mip(level, mx, my, mw, mh, &pixels[(my - (y0 >> level)) * w + (mx - (x0 >> level))], w, full);
+    }
+}
+
+/*!
+ * \brief Store a rectangle of a mip level at its wrapped position in the ring.
+ * \param x Position in texels of the mip level.
+ * \param row_length Row length of \p pixels.
+ */
+void SharedVolume::upload_mip(int level, int64_t x, int64_t y, int64_t width, int64_t height,
+                              const uint32_t *pixels, int64_t row_length, bool full)
+{
+    const int64_t w = m_ring.texture_width >> level;
+    const int64_t h = m_ring.texture_height >> level;
+    const int64_t depth = std::max<int64_t>(1, m_ring.depth >> level);
+
+    // split at the seams where the ring wraps around
+    for (int64_t j = 0; j < height; ) {
+        const int64_t ty = wrap(y + j, h);
+        const int64_t rows = std::min(height - j, h - ty);
+        for (int64_t i = 0; i < width; ) {
+            const int64_t tx = wrap(x + i, w);
+            const int64_t columns = std::min(width - i, w - tx);
+            const uint32_t *src = pixels + j * row_length + i;
+
+            if (full) {
+                m_texture.upload(level, tx, ty, 0, columns, rows, depth, GL_RGBA, GL_UNSIGNED_BYTE,
+                                 src, row_length, TextureStream::REPEAT_SLICE);
+            }
+            else {
+                m_texture.update(level, tx, ty, 0, columns, rows, depth, GL_RGBA, GL_UNSIGNED_BYTE,
+                                 src, row_length, TextureStream::REPEAT_SLICE);
+            }
+            i += columns;
+        }
+        j += rows;
+    }
+}
+
+/*!
+ * \brief Copy a rectangle of the base level to its wrapped position in
+ * m_ring_data.
+ * \param x Slide position, in pixels of the ring's level.
+ * \param row_length Row length of \p pixels.
+ */
+void SharedVolume::store_ring_data(int64_t x, int64_t y, int64_t width, int64_t height,
+                                   const uint32_t *pixels, int64_t row_length)
+{
+    const int64_t w = m_ring.texture_width;
+    const int64_t h = m_ring.texture_height;
+    for (int64_t j = 0; j < height; j++) {
+        const int64_t ty = wrap(y + j, h);
+        for (int64_t i = 0; i < width; ) {
+            const int64_t tx = wrap(x + i, w);
+            const int64_t columns = std::min(width - i, w - tx);
+            const uint32_t *src = pixels + j * row_length + i;
+            std::copy(src, src + columns, &m_ring_data[ty * w + tx]);
+            i += columns;
+        }
+    }
+}
+
+/*!
+ * \brief Decoded base level of the most recent region: one slice of the
+ * ring, laid out as given by latest_layout().
+ *
+ * The slice is only kept up to date once it has been asked for; the first
+ * call reads it back from the slide.
+ */
+const std::vector<uint32_t>& SharedVolume::latest_pixels()
+{
+    if (!m_keep_ring_data) {
+        m_keep_ring_data = true;
+        m_ring_data.assign(m_ring.texture_width * m_ring.texture_height, 0);
+        if (m_ring.texture_width > 0) {
+            std::vector<uint32_t> pixels(m_ring.texture_width * m_ring.texture_height);
+            volume->read_region(m_ring.level, m_ring.x, m_ring.y, m_ring.texture_width, m_ring.texture_height,
+                                pixels.data());
+            store_ring_data(m_ring.x, m_ring.y, m_ring.texture_width, m_ring.texture_height,
+                            pixels.data(), m_ring.texture_width);
+        }
+    }
+    return m_ring_data;
+}
+
+/*!
+ * \brief Texture holding the most recent region whose upload has completed.
+ */
+GLuint SharedVolume::texture()
+{
+    GLuint texture = m_texture.texture();
+    if (!m_texture.pending() && m_generation != m_uploaded_generation) {
+        m_front_ring = m_ring;
+        m_generation = m_uploaded_generation;
+    }
+    return texture;
+}
+
+/*!
+ * \brief Layout of the most recent region in the ring, which texture() holds
+ * once generation() reaches latest_generation().
+ */
+RingLayout SharedVolume::latest_layout()
+{
+    RingLayout layout {0, 0, (int) m_ring.width, (int) m_ring.height, (int) m_ring.depth,
+                       (int) m_ring.texture_width, (int) m_ring.texture_height};
+    if (m_ring.texture_width > 0) {
+        layout.x = wrap(m_ring.x, m_ring.texture_width);
+        layout.y = wrap(m_ring.y, m_ring.texture_height);
+    }
+    return layout;
+}
+
+/*!
+ * \brief Size of the region held by texture().
+ */
+QVector3D SharedVolume::size()
+{
+    return QVector3D(m_front_ring.width, m_front_ring.height, m_front_ring.depth);
+}
+
+/*!
+ * \brief Slide window shown by texture(), in pixels of its level.
+ */
+OSVolume::Region SharedVolume::region()
+{
+    return OSVolume::Region {m_front_ring.level, m_front_ring.x, m_front_ring.y,
+                             m_front_ring.width, m_front_ring.height, m_front_ring.depth};
+}
+
+/*!
+ * \brief Size of the ring buffer texture holding the region, in texels of
+ * its base level.
+ */
+QVector3D SharedVolume::texture_size()
+{
+    return QVector3D(m_front_ring.texture_width, m_front_ring.texture_height, m_front_ring.depth);
+}
+
+/*!
+ * \brief Texture coordinate of the region's origin in the ring.
+ */
+QVector3D SharedVolume::offset()
+{
+    if (m_front_ring.texture_width == 0) {
+        return QVector3D(0.0f, 0.0f, 0.0f);
+    }
+    return QVector3D(wrap(m_front_ring.x, m_front_ring.texture_width) / (float) m_front_ring.texture_width,
+                     wrap(m_front_ring.y, m_front_ring.texture_height) / (float) m_front_ring.texture_height,
+                     0.0f);
+}
+
+/*!
+ * \brief Extent of the region in texture coordinates of the ring.
+ */
+QVector3D SharedVolume::scale()
+{
+    if (m_front_ring.texture_width == 0) {
+        return QVector3D(1.0f, 1.0f, 1.0f);
+    }
+    return QVector3D(m_front_ring.width / (float) m_front_ring.texture_width,
+                     m_front_ring.height / (float) m_front_ring.texture_height,
+                     1.0f);
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <QOpenGLExtraFunctions>
+#include <QVector3D>
+
+#include "coloroccupancy.h"
+#include "osvolume.h"
+#include "texturestream.h"
+#include "tfbaker.h"
+
+/*!
+ * \brief Slide data and volume texture shared by all canvases showing the
+ * same file.
+ *
+ * Instances are reference counted and looked up by file name, so opening a
+ * slide that is already open in another view neither decodes it again nor
+ * uploads a second texture. Sharing the texture requires the canvases to use
+ * sharing OpenGL contexts (Qt::AA_ShareOpenGLContexts). The visible region
+ * (zoom, pan and level) is shared too; TFs and camera stay per view.
+ *
+ * The region is held in a ring buffer texture that wraps around in x and y.
+ * Panning only uploads the newly exposed strips, and the shader maps volume
+ * coordinates into the ring with offset() and scale().
+ *
+ * The texture's mip levels are filled from the slide's coarser pyramid levels
+ * where they exist, and reduced from the level above otherwise.
+ *
+ * The colours of every texel uploaded are counted in occupancy(). Panning
+ * only adds colours; other changes start the count afresh.
+ */
+class SharedVolume : protected QOpenGLExtraFunctions
+{
+public:
+    static std::shared_ptr<SharedVolume> acquire(const std::string& filename);
+    virtual ~SharedVolume();
+
+    SharedVolume(const SharedVolume&) = delete;
+    SharedVolume& operator=(const SharedVolume&) = delete;
+
+    void update_texture();
+
+    GLuint texture();
+    bool pending() { return m_texture.pending(); }
+
+    QVector3D size();
+    OSVolume::Region region();
+    QVector3D offset();
+    QVector3D scale();
+    QVector3D texture_size();
+
+    /*!
+     * \brief Number of mip levels of texture().
+     */
+    int levels() { return MIP_LEVELS; }
+
+    /*!
+     * \brief Counter incremented each time a new region reaches texture(),
+     * used by the views to notice changes made through another view.
+     */
+    unsigned int generation() { return m_generation; }
+
+    const std::vector<uint32_t>& latest_pixels();
+    RingLayout latest_layout();
+
+    /*!
+     * \brief Value of generation() once the most recent region is drawn.
+     */
+    unsigned int latest_generation() { return m_uploaded_generation; }
+
+    /*!
+     * \brief Colours present in the most recent region, at every mip level.
+     */
+    const ColorOccupancy& occupancy() { return m_occupancy; }
+
+    OSVolume *volume;
+
+private:
+    static const int MIP_LEVELS = 5;
+
+    // ring buffer texture rows and columns are a multiple of this, so every
+    // mip level wraps around at the same texels as the base level
+    static const int RING_ALIGNMENT = 1 << (MIP_LEVELS - 1);
+
+    struct Ring {
+        int level {-1};
+        int64_t x {0}, y {0};                     /*!< Slide position of the visible window. */
+        int64_t width {0}, height {0}, depth {0}; /*!< Size of the visible window. */
+        int64_t texture_width {0}, texture_height {0};
+    };
+
+    explicit SharedVolume(const std::string& filename);
+
+    void upload_rect(int64_t x, int64_t y, int64_t width, int64_t height, bool full);
+    void upload_mip(int level, int64_t x, int64_t y, int64_t width, int64_t height,
+                    const uint32_t *pixels, int64_t row_length, bool full);
+    void store_ring_data(int64_t x, int64_t y, int64_t width, int64_t height,
+                         const uint32_t *pixels, int64_t row_length);
+
+    std::string m_filename;
+    TextureStream m_texture {GL_TEXTURE_3D, GL_LINEAR_MIPMAP_LINEAR, GL_REPEAT};
+    Ring m_ring;        /*!< Layout of the most recent upload. */
+    Ring m_front_ring;  /*!< Layout of the texture being drawn. */
+    std::vector<uint32_t> m_ring_data;  /*!< Decoded copy of one ring slice, once latest_pixels() is used. */
+    bool m_keep_ring_data {false};
+    ColorOccupancy m_occupancy;
+    unsigned int m_generation {0};
+    unsigned int m_uploaded_generation {0};
+
+    static std::map<std::string, std::weak_ptr<SharedVolume>> s_volumes;
+};
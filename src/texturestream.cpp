@@ -0,0 +1,337 @@
+#include "texturestream.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <QOpenGLContext>
+
+// upper bound for one staging buffer; larger uploads are split into chunks
+static const size_t STAGING_BYTES = 32 * 1024 * 1024;
+
+
+/*!
+ * \brief Size in bytes of a texel in client memory.
+ */
+static size_t texel_size(GLenum format, GLenum type)
+{
+    switch (type) {
+    case GL_UNSIGNED_INT_8_8_8_8:
+    case GL_UNSIGNED_INT_8_8_8_8_REV:
+        return 4;
+    default:
+        break;
+    }
+
+    size_t components = 4;
+    switch (format) {
+    case GL_RED: components = 1; break;
+    case GL_RG: components = 2; break;
+    case GL_RGB: components = 3; break;
+    default: break;
+    }
+
+    switch (type) {
+    case GL_FLOAT: return 4 * components;
+    case GL_HALF_FLOAT: return 2 * components;
+    default: return components;
+    }
+}
+
+
+/*!
+ * \brief Constructor.
+ * \param target GL_TEXTURE_2D, GL_TEXTURE_3D or GL_TEXTURE_2D_ARRAY.
+ * \param filter Minification filter; magnification uses its non-mipmap
+ * counterpart.
+ * \param wrap Wrap mode for all axes.
+ */
+TextureStream::TextureStream(GLenum target, GLint filter, GLint wrap)
+    : m_target {target}
+    , m_filter {filter}
+    , m_wrap {wrap}
+{
+    initializeOpenGLFunctions();
+    glGenBuffers(2, m_pbos);
+}
+
+
+/*!
+ * \brief Destructor.
+ */
+TextureStream::~TextureStream()
+{
+    if (!QOpenGLContext::currentContext()) {
+        return;
+    }
+    if (m_fence) {
+        glDeleteSync(m_fence);
+    }
+    for (int i = 0; i < 2; i++) {
+        if (m_pbo_fences[i]) {
+            glDeleteSync(m_pbo_fences[i]);
+        }
+    }
+    glDeleteBuffers(2, m_pbos);
+    glDeleteTextures(2, m_textures);
+}
+
+
+/*!
+ * \brief Start a full upload into the back texture.
+ * \param internal_format Sized internal format, e.g. GL_R8.
+ * \param levels Number of mip levels to allocate.
+ *
+ * If a previous full upload is still in flight, it is superseded.
+ */
+void TextureStream::begin(GLint internal_format, int width, int height, int depth, int levels)
+{
+    if (m_fence) {
+        glDeleteSync(m_fence);
+        m_fence = nullptr;
+    }
+
+    const int back = 1 - m_front;
+    const Layout layout {internal_format, width, height, depth, levels};
+    const Layout& current = m_layouts[back];
+    if (m_textures[back] == 0 || current.internal_format != internal_format
+            || current.width != width || current.height != height
+            || current.depth != depth || current.levels != levels) {
+        allocate(back, layout);
+    }
+}
+
+
+/*!
+ * \brief Upload a box of texels into the back texture.
+ * \param row_length Row length of \p data in texels, if it differs from \p width.
+ * \param image_height Image height of \p data in rows, if it differs from \p height.
+ *
+ * Must be called between begin() and end().
+ */
+void TextureStream::upload(int level, int x, int y, int z, int width, int height, int depth,
+                           GLenum format, GLenum type, const void *data,
+                           int row_length, int image_height)
+{
+    transfer(m_textures[1 - m_front], level, x, y, z, width, height, depth,
+             format, type, data, row_length, image_height);
+}
+
+
+/*!
+ * \brief Finish a full upload.
+ *
+ * The new texture replaces the current one as soon as the transfer has
+ * completed, or immediately if there is nothing to draw yet.
+ */
+void TextureStream::end()
+{
+    m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    if (m_textures[m_front] == 0) {
+        glDeleteSync(m_fence);
+        m_fence = nullptr;
+        m_front = 1 - m_front;
+    }
+}
+
+
+/*!
+ * \brief Replace the whole texture with a single level.
+ */
+void TextureStream::upload(GLint internal_format, int width, int height, int depth,
+                           GLenum format, GLenum type, const void *data)
+{
+    begin(internal_format, width, height, depth);
+    upload(0, 0, 0, 0, width, height, depth, format, type, data);
+    end();
+}
+
+
+/*!
+ * \brief Update a box of texels in the most recent texture.
+ *
+ * If a full upload is in flight, the update applies to it, since it is about
+ * to replace the current texture.
+ */
+void TextureStream::update(int level, int x, int y, int z, int width, int height, int depth,
+                           GLenum format, GLenum type, const void *data,
+                           int row_length, int image_height)
+{
+    const int index = m_fence ? 1 - m_front : m_front;
+    if (m_textures[index] == 0) {
+        return;
+    }
+    transfer(m_textures[index], level, x, y, z, width, height, depth,
+             format, type, data, row_length, image_height);
+}
+
+
+/*!
+ * \brief Texture to be drawn.
+ *
+ * Swaps in the texture of the last full upload once its transfer has
+ * completed. Never blocks.
+ */
+GLuint TextureStream::texture()
+{
+    if (m_fence) {
+        const GLenum status = glClientWaitSync(m_fence, 0, 0);
+        if (status != GL_TIMEOUT_EXPIRED) {
+            glDeleteSync(m_fence);
+            m_fence = nullptr;
+            m_front = 1 - m_front;
+        }
+    }
+    return m_textures[m_front];
+}
+
+
+/*!
+ * \brief (Re)create a texture with immutable storage for the given layout.
+ */
+void TextureStream::allocate(int index, const Layout& layout)
+{
+    glDeleteTextures(1, &m_textures[index]);
+    glGenTextures(1, &m_textures[index]);
+    m_layouts[index] = layout;
+
+    glBindTexture(m_target, m_textures[index]);
+    glTexParameteri(m_target, GL_TEXTURE_WRAP_S, m_wrap);
+    glTexParameteri(m_target, GL_TEXTURE_WRAP_T, m_wrap);
+    if (m_target == GL_TEXTURE_3D) {
+        glTexParameteri(m_target, GL_TEXTURE_WRAP_R, m_wrap);
+    }
+    const bool nearest = m_filter == GL_NEAREST || m_filter == GL_NEAREST_MIPMAP_NEAREST
+            || m_filter == GL_NEAREST_MIPMAP_LINEAR;
+    glTexParameteri(m_target, GL_TEXTURE_MIN_FILTER, m_filter);
+    glTexParameteri(m_target, GL_TEXTURE_MAG_FILTER, nearest ? GL_NEAREST : GL_LINEAR);
+    glTexParameteri(m_target, GL_TEXTURE_MAX_LEVEL, layout.levels - 1);
+
+    if (m_target == GL_TEXTURE_2D) {
+        glTexStorage2D(m_target, layout.levels, layout.internal_format, layout.width, layout.height);
+    }
+    else {
+        glTexStorage3D(m_target, layout.levels, layout.internal_format, layout.width, layout.height, layout.depth);
+    }
+    glBindTexture(m_target, 0);
+}
+
+
+/*!
+ * \brief Upload a box, split into chunks that fit a staging buffer.
+ */
+void TextureStream::transfer(GLuint texture, int level, int x, int y, int z, int width, int height, int depth,
+                             GLenum format, GLenum type, const void *data, int row_length, int image_height)
+{
+    if (width <= 0 || height <= 0 || depth <= 0) {
+        return;
+    }
+
+    const size_t texel = texel_size(format, type);
+    const size_t row_bytes = texel * width;
+    const size_t slice_bytes = row_bytes * height;
+    const size_t src_row = texel * (row_length > 0 ? row_length : width);
+    const size_t src_slice = image_height == REPEAT_SLICE ? 0 : src_row * (image_height > 0 ? image_height : height);
+    const unsigned char *src = static_cast<const unsigned char*>(data);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (slice_bytes <= STAGING_BYTES) {
+        const int slices = std::max<size_t>(1, STAGING_BYTES / slice_bytes);
+        for (int k = 0; k < depth; k += slices) {
+            stage(texture, level, x, y, z + k, width, height, std::min(slices, depth - k),
+                  format, type, src + k * src_slice, src_row, src_slice);
+        }
+    }
+    else {
+        const int rows = std::max<size_t>(1, STAGING_BYTES / row_bytes);
+        for (int k = 0; k < depth; k++) {
+            for (int j = 0; j < height; j += rows) {
+                stage(texture, level, x, y + j, z + k, width, std::min(rows, height - j), 1,
+                      format, type, src + k * src_slice + j * src_row, src_row, src_slice);
+            }
+        }
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+
+/*!
+ * \brief Copy a box into the next staging buffer and start its transfer.
+ *
+ * A staging buffer still in use by a previous transfer is orphaned rather
+ * than waited for.
+ */
+void TextureStream::stage(GLuint texture, int level, int x, int y, int z, int width, int height, int depth,
+                          GLenum format, GLenum type, const unsigned char *data, size_t src_row, size_t src_slice)
+{
+    const int i = m_next_pbo;
+    m_next_pbo = 1 - m_next_pbo;
+
+    const size_t row_bytes = texel_size(format, type) * width;
+    const size_t bytes = row_bytes * height * depth;
+
+    bool in_use = false;
+    if (m_pbo_fences[i]) {
+        in_use = glClientWaitSync(m_pbo_fences[i], 0, 0) == GL_TIMEOUT_EXPIRED;
+        glDeleteSync(m_pbo_fences[i]);
+        m_pbo_fences[i] = nullptr;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbos[i]);
+    GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+    if (in_use || m_pbo_sizes[i] < bytes) {
+        m_pbo_sizes[i] = std::max(bytes, std::min(m_pbo_sizes[i], STAGING_BYTES));
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, m_pbo_sizes[i], nullptr, GL_STREAM_DRAW);
+    }
+    else {
+        access |= GL_MAP_UNSYNCHRONIZED_BIT;
+    }
+
+    unsigned char *dst = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, access));
+    const void *pixels = nullptr;
+    if (dst) {
+        const size_t slice_bytes = row_bytes * height;
+        if (src_row == row_bytes && src_slice == slice_bytes) {
+            std::memcpy(dst, data, bytes);
+        }
+        else {
+            for (int k = 0; k < depth; k++) {
+                if (src_row == row_bytes) {
+                    std::memcpy(dst + k * slice_bytes, data + k * src_slice, slice_bytes);
+                    continue;
+                }
+                for (int j = 0; j < height; j++) {
+                    std::memcpy(dst + k * slice_bytes + j * row_bytes, data + k * src_slice + j * src_row, row_bytes);
+                }
+            }
+        }
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    else {
+        // mapping failed, fall back to a plain client memory upload
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, src_row / texel_size(format, type));
+        pixels = data;
+    }
+
+    glBindTexture(m_target, texture);
+    if (m_target == GL_TEXTURE_2D) {
+        glTexSubImage2D(m_target, level, x, y, width, height, format, type, pixels);
+    }
+    else if (dst) {
+        glTexSubImage3D(m_target, level, x, y, z, width, height, depth, format, type, pixels);
+    }
+    else {
+        for (int k = 0; k < depth; k++) {
+            glTexSubImage3D(m_target, level, x, y, z + k, width, height, 1, format, type, data + k * src_slice);
+        }
+    }
+    glBindTexture(m_target, 0);
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    if (dst) {
+        m_pbo_fences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+}
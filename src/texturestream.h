@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+
+#include <QOpenGLExtraFunctions>
+
+/*!
+ * \brief Texture whose uploads are staged through pixel unpack buffers and
+ * completed asynchronously.
+ *
+ * A full upload (begin(), upload(), end()) goes to a back texture, while the
+ * front texture keeps being drawn. Once the fence placed after the transfer
+ * has signalled, texture() swaps the new texture in. Partial updates go to the
+ * most recent texture. Staging uses two pixel unpack buffers in turn, so
+ * filling one does not wait for the previous transfer to finish.
+ *
+ * Supports GL_TEXTURE_2D, GL_TEXTURE_3D and GL_TEXTURE_2D_ARRAY. Requires a
+ * current OpenGL context for all calls, including construction.
+ */
+class TextureStream : protected QOpenGLExtraFunctions
+{
+public:
+    /*!
+     * \brief Value for \p image_height meaning that every slice of the box
+     * reads the same image.
+     */
+    static const int REPEAT_SLICE = -1;
+
+    TextureStream(GLenum target, GLint filter, GLint wrap);
+    virtual ~TextureStream();
+
+    TextureStream(const TextureStream&) = delete;
+    TextureStream& operator=(const TextureStream&) = delete;
+
+    void begin(GLint internal_format, int width, int height, int depth, int levels = 1);
+    void upload(int level, int x, int y, int z, int width, int height, int depth,
+                GLenum format, GLenum type, const void *data,
+                int row_length = 0, int image_height = 0);
+    void end();
+
+    void upload(GLint internal_format, int width, int height, int depth,
+                GLenum format, GLenum type, const void *data);
+
+    void update(int level, int x, int y, int z, int width, int height, int depth,
+                GLenum format, GLenum type, const void *data,
+                int row_length = 0, int image_height = 0);
+
+    GLuint texture();
+
+    /*!
+     * \brief Texture being filled between begin() and end(), for writes
+     * other than upload(), e.g. image stores.
+     */
+    GLuint back() { return m_textures[1 - m_front]; }
+
+    /*!
+     * \brief Texture that update() writes to, 0 if there is none yet.
+     */
+    GLuint latest() { return m_textures[m_fence ? 1 - m_front : m_front]; }
+
+    /*!
+     * \brief Whether a full upload is still in flight.
+     */
+    bool pending() { return m_fence != nullptr; }
+
+    /*!
+     * \brief Whether any upload has completed, i.e. texture() is usable.
+     */
+    bool valid() { return m_textures[m_front] != 0; }
+
+private:
+    struct Layout {
+        GLint internal_format {0};
+        int width {0}, height {0}, depth {0}, levels {0};
+    };
+
+    GLenum m_target;
+    GLint m_filter;
+    GLint m_wrap;
+
+    GLuint m_textures[2] {0, 0};
+    Layout m_layouts[2];
+    int m_front {0};
+    GLsync m_fence {nullptr};   /*!< Guards the back texture while it is uploaded. */
+
+    GLuint m_pbos[2] {0, 0};
+    size_t m_pbo_sizes[2] {0, 0};
+    GLsync m_pbo_fences[2] {nullptr, nullptr};
+    int m_next_pbo {0};
+
+    void allocate(int index, const Layout& layout);
+    void transfer(GLuint texture, int level, int x, int y, int z, int width, int height, int depth,
+                  GLenum format, GLenum type, const void *data, int row_length, int image_height);
+    void stage(GLuint texture, int level, int x, int y, int z, int width, int height, int depth,
+               GLenum format, GLenum type, const unsigned char *data, size_t src_row, size_t src_slice);
+};
@@ -0,0 +1,592 @@
+#include "tfbaker.h"
+#include "coloroccupancy.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+/*!
+ * \brief Convert opacities in [0, 1] to 8 bit fixed point.
+ * \param src Input opacities.
+ * \param dst Output, \p n bytes.
+ * \param n Number of values.
+ */
+void pack_unorm8(const float *src, uint8_t *dst, int n)
+{
+    int i = 0;
+#ifdef __SSE2__
+    // 16 values per iteration, saturating packs clamp to [0, 255]
+    const __m128 scale = _mm_set1_ps(255.0f);
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i), scale));
+        __m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale));
+        __m128i c = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 8), scale));
+        __m128i d = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 12), scale));
+        __m128i ab = _mm_packs_epi32(a, b);
+        __m128i cd = _mm_packs_epi32(c, d);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(ab, cd));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = static_cast<uint8_t>(std::lrint(std::clamp(src[i], 0.0f, 1.0f) * 255.0f));
+    }
+}
+
+
+/*!
+ * \brief Interleave opacities, as 8 bit fixed point, with coverage flags.
+ * \param opacity Input opacities in [0, 1].
+ * \param coverage Input, non-zero where some primitive covers the texel.
+ * \param dst Output, 2 * \p n bytes for a GL_RG8 texture.
+ */
+void pack_rg8(const float *opacity, const uint8_t *coverage, uint8_t *dst, int n)
+{
+    std::vector<uint8_t> packed(n);
+    pack_unorm8(opacity, packed.data(), n);
+    for (int i = 0; i < n; i++) {
+        dst[2 * i] = packed[i];
+        dst[2 * i + 1] = coverage[i] ? 255 : 0;
+    }
+}
+
+
+/*!
+ * \brief Multiply a run of values by a constant.
+ */
+static void scale_span(float *values, int n, float factor)
+{
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 f = _mm_set1_ps(factor);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(values + i, _mm_mul_ps(_mm_loadu_ps(values + i), f));
+    }
+#endif
+    for (; i < n; i++) {
+        values[i] *= factor;
+    }
+}
+
+
+/*!
+ * \brief Largest integer whose square does not exceed \p value.
+ */
+static int isqrt(int value)
+{
+    int root = static_cast<int>(std::sqrt(static_cast<double>(value)));
+    while (root * root > value) {
+        root--;
+    }
+    while ((root + 1) * (root + 1) <= value) {
+        root++;
+    }
+    return root;
+}
+
+
+namespace {
+
+ColorTFSphere make_sphere(const ColorTF& tf, int n)
+{
+    // picks are given in 0-255 colour units
+    const float unit = (n - 1) / 255.0f;
+    const float radius = std::max(0, tf.proximity_radius) * unit;
+    return {static_cast<int>(std::lrint(qRed(tf.rgb) * unit)),
+            static_cast<int>(std::lrint(qGreen(tf.rgb) * unit)),
+            static_cast<int>(std::lrint(qBlue(tf.rgb) * unit)),
+            static_cast<int>(radius * radius),
+            tf.opacity};
+}
+
+} // namespace
+
+
+/*!
+ * \brief Smallest box containing both boxes.
+ */
+TFBox TFBox::united(const TFBox& other) const
+{
+    if (empty()) {
+        return other;
+    }
+    if (other.empty()) {
+        return *this;
+    }
+    return {std::min(x0, other.x0), std::min(y0, other.y0), std::min(z0, other.z0),
+            std::max(x1, other.x1), std::max(y1, other.y1), std::max(z1, other.z1)};
+}
+
+/*!
+ * \brief Cells common to both boxes.
+ */
+TFBox TFBox::intersected(const TFBox& other) const
+{
+    return {std::max(x0, other.x0), std::max(y0, other.y0), std::max(z0, other.z0),
+            std::min(x1, other.x1), std::min(y1, other.y1), std::min(z1, other.z1)};
+}
+
+/*!
+ * \brief Whether every cell of \p other is in this box.
+ */
+bool TFBox::contains(const TFBox& other) const
+{
+    return x0 <= other.x0 && y0 <= other.y0 && z0 <= other.z0
+        && x1 >= other.x1 && y1 >= other.y1 && z1 >= other.z1;
+}
+
+
+/*!
+ * \brief Cells of an n^3 colour proximity TF affected by a colour pick.
+ */
+TFBox color_tf_footprint(const ColorTF& tf, int n)
+{
+    const ColorTFSphere s = make_sphere(tf, n);
+    const int e = isqrt(s.radius_2);
+    return {std::max(0, s.x - e), std::max(0, s.y - e), std::max(0, s.z - e),
+            std::min(n, s.x + e + 1), std::min(n, s.y + e + 1), std::min(n, s.z + e + 1)};
+}
+
+
+/*!
+ * \brief Colour picks that change an n^3 colour proximity TF, in cell units.
+ */
+std::vector<ColorTFSphere> color_tf_spheres(const std::vector<ColorTF>& tfs, int n)
+{
+    std::vector<ColorTFSphere> spheres;
+    spheres.reserve(tfs.size());
+    for (const ColorTF& tf : tfs) {
+        if (tf.proximity_radius >= 0 && tf.opacity != 1.0f) {
+            spheres.push_back(make_sphere(tf, n));
+        }
+    }
+    return spheres;
+}
+
+
+/*!
+ * \brief Rasterise the whole colour proximity TF.
+ */
+void bake_color_proximity_tf(const std::vector<ColorTF>& tfs, int n, uint8_t *dst)
+{
+    bake_color_proximity_tf(tfs, n, dst, TFBox {0, 0, 0, n, n, n});
+}
+
+
+/*!
+ * \brief Rasterise a box of the colour proximity TF.
+ * \param tfs Colour picks; each scales the opacity of the colours within its
+ * radius (inclusive) by its own opacity.
+ * \param n Size of the TF along each axis of the RGB cube.
+ * \param dst Output, n^3 bytes indexed [blue][green][red]. Only cells inside
+ * \p box are written.
+ * \param box Cells to be recomputed.
+ * \param cancelled If given and set, the bake stops early, leaving the box
+ * partly written.
+ * \param occupied If given, a flag per brick of ColorOccupancy; cells in
+ * bricks without the flag are left as they are.
+ *
+ * Each sphere is only visited over its bounding box: the rows it crosses,
+ * and within a row the span given by its integer squared radius.
+ */
+void bake_color_proximity_tf(const std::vector<ColorTF>& tfs, int n, uint8_t *dst, const TFBox& box,
+                             const std::atomic<bool> *cancelled, const uint8_t *occupied)
+{
+    if (box.empty()) {
+        return;
+    }
+
+    const std::vector<ColorTFSphere> spheres = color_tf_spheres(tfs, n);
+
+    const int width = box.x1 - box.x0;
+
+    // colour brick of each cell, and the first cell of each brick along x
+    const int bricks = ColorOccupancy::COLOR_BRICKS;
+    std::vector<int> brick(n);
+    std::vector<int> brick_begin(bricks + 1, n);
+    for (int c = n - 1; c >= 0; c--) {
+        brick[c] = std::min(bricks - 1, (int) ((c + 0.5f) * 256 / n) / ColorOccupancy::COLOR_BRICK);
+        brick_begin[brick[c]] = c;
+    }
+    for (int b = bricks - 1; b >= 0; b--) {
+        brick_begin[b] = std::min(brick_begin[b], brick_begin[b + 1]);
+    }
+
+    // work is concentrated around the picked colours, so slabs are handed out
+    // dynamically
+    #pragma omp parallel
+    {
+        std::vector<float> row(width);
+        std::vector<int> slab;
+        std::vector<std::pair<int, int>> runs;
+        #pragma omp for schedule(dynamic)
+        for (int k = box.z0; k < box.z1; k++) {
+            if (cancelled && *cancelled) {
+                continue;
+            }
+            slab.clear();
+            for (int l = 0; l < (int) spheres.size(); l++) {
+                const int dz = k - spheres[l].z;
+                if (dz * dz <= spheres[l].radius_2) {
+                    slab.push_back(l);
+                }
+            }
+
+            for (int j = box.y0; j < box.y1; j++) {
+                // runs of cells to bake: the box, or its occupied bricks
+                runs.clear();
+                if (occupied) {
+                    const uint8_t *flags = &occupied[(brick[k] * bricks + brick[j]) * bricks];
+                    for (int b = brick[box.x0]; b <= brick[box.x1 - 1]; b++) {
+                        if (!flags[b]) {
+                            continue;
+                        }
+                        const int begin = std::max(box.x0, brick_begin[b]);
+                        const int end = std::min(box.x1, brick_begin[b + 1]);
+                        if (!runs.empty() && runs.back().second == begin) {
+                            runs.back().second = end;
+                        }
+                        else {
+                            runs.push_back({begin, end});
+                        }
+                    }
+                }
+                else {
+                    runs.push_back({box.x0, box.x1});
+                }
+
+                for (const auto& run : runs) {
+                    uint8_t *out = &dst[((size_t) k * n + j) * n + run.first];
+                    float *values = &row[run.first - box.x0];
+                    const int length = run.second - run.first;
+                    bool touched = false;
+                    for (int l : slab) {
+                        const ColorTFSphere& s = spheres[l];
+                        const int dz = k - s.z;
+                        const int dy = j - s.y;
+                        const int remainder = s.radius_2 - dz * dz - dy * dy;
+                        if (remainder < 0) {
+                            continue;
+                        }
+                        const int half = isqrt(remainder);
+                        const int begin = std::max(run.first, s.x - half);
+                        const int end = std::min(run.second - 1, s.x + half);
+                        if (begin > end) {
+                            continue;
+                        }
+                        if (!touched) {
+                            std::fill(values, values + length, 1.0f);
+                            touched = true;
+                        }
+                        scale_span(&row[begin - box.x0], end - begin + 1, s.opacity);
+                    }
+                    if (touched) {
+                        pack_unorm8(values, out, length);
+                    }
+                    else {
+                        std::fill(out, out + length, 255);
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+// rows per band of the polygon mask's spatial index
+static const int POLYGON_BAND = 16;
+
+/*!
+ * \brief Rasterise a box of the polygon mask.
+ * \param polygons Polygons, in volume coordinates.
+ * \param layers Mask layer of each polygon.
+ * \param width Width of the mask.
+ * \param height Height of the mask.
+ * \param dst Output, opacity and coverage byte pairs indexed
+ * [layer][row][column]. Only texels inside \p box are written.
+ * \param box Texels to be recomputed; z is the layer.
+ * \param cancelled If given and set, the bake stops early, leaving the box
+ * partly written.
+ *
+ * Each texel holds the product of the opacities of the layer's polygons
+ * containing it, and whether any does. Polygons are indexed by bands of
+ * rows, so that each row only visits those whose bounding box it crosses:
+ * thousands of small annotations cost about as much as a few large ones.
+ */
+void bake_polygon_mask(std::vector<Polygon>& polygons, const std::vector<int>& layers,
+                       int width, int height, uint8_t *dst, const TFBox& box,
+                       const std::atomic<bool> *cancelled)
+{
+    const int w = width;
+    const int h = height;
+    const int bw = box.x1 - box.x0;
+
+    // texel rows of the box, bucketed into bands of the spatial index
+    const int bands = (box.y1 - box.y0 + POLYGON_BAND - 1) / POLYGON_BAND;
+    std::vector<std::vector<int>> band_polygons;
+
+    for (int layer = box.z0; layer < box.z1; layer++) {
+        // polygons of the layer whose bounding box meets the box, each
+        // listed in the bands of rows it spans
+        std::vector<int> layer_polygons;
+        band_polygons.assign(std::max(bands, 0), std::vector<int>());
+        for (int k = 0; k < (int) polygons.size(); k++) {
+            float min_x, min_y, max_x, max_y;
+            if (layers[k] != layer || !polygons[k].bounds(min_x, min_y, max_x, max_y)) {
+                continue;
+            }
+            // texels are sampled at their corner, i/w
+            const int first = std::max(box.y0, (int) std::floor(min_y * h));
+            const int last = std::min(box.y1 - 1, (int) std::ceil(max_y * h));
+            if (first > last || std::ceil(max_x * w) < box.x0 || std::floor(min_x * w) >= box.x1) {
+                continue;
+            }
+            layer_polygons.push_back(k);
+            for (int band = (first - box.y0) / POLYGON_BAND; band <= (last - box.y0) / POLYGON_BAND; band++) {
+                band_polygons[band].push_back(k);
+            }
+        }
+
+        // scan convert the polygons, so that the work is proportional to
+        // their area and edge count
+        #pragma omp parallel for schedule(dynamic)
+        for (int l = 0; l < (int) layer_polygons.size(); l++) {
+            polygons[layer_polygons[l]].build_edge_table(h);
+        }
+
+        #pragma omp parallel for
+        for (int j = box.y0; j < box.y1; j++) {
+            if (cancelled && *cancelled) {
+                continue;
+            }
+            std::vector<float> row(bw, 1.0f);
+            std::vector<uint8_t> covered(bw, 0);
+            std::vector<std::pair<int, int>> spans;
+            for (int k : band_polygons[(j - box.y0) / POLYGON_BAND]) {
+                const float opacity = polygons[k].get_opacity();
+                polygons[k].row_spans(j, w, h, spans);
+                for (const auto& span : spans) {
+                    const int begin = std::max(span.first, box.x0);
+                    const int end = std::min(span.second, box.x1);
+                    for (int i = begin; i < end; i++) {
+                        row[i - box.x0] *= opacity;
+                        covered[i - box.x0] = 1;
+                    }
+                }
+            }
+            pack_rg8(row.data(), covered.data(), &dst[2 * (((size_t) layer * h + j) * w + box.x0)], bw);
+        }
+    }
+}
+
+
+/*!
+ * \brief Pre-integrate a scalar TF: the opacity of a ray segment along which
+ * the scalar varies linearly between two values.
+ * \param opacities Input, opacity per reference step length at
+ * (n - 1) * subdivisions + 1 evenly spaced scalars.
+ * \param n Number of table entries per axis; entry i is the scalar
+ * i / (n - 1).
+ * \param subdivisions Input samples per table interval.
+ * \param dst Output, n * n opacities indexed [back][front], for segments
+ * of the reference step length.
+ *
+ * Opacities are turned into extinctions, integrated once into a running sum,
+ * and each entry is the mean extinction between its two scalars turned back
+ * into an opacity. Entries with equal scalars hold the TF itself.
+ */
+void bake_preintegrated_tf(const float *opacities, int n, int subdivisions, float *dst)
+{
+    // fully opaque samples would have an infinite extinction
+    const float max_opacity = 1.0f - 1.0f / 4096.0f;
+    const int m = (n - 1) * subdivisions + 1;
+    std::vector<double> integral(m, 0.0);
+    double previous = -std::log(1.0 - std::min(opacities[0], max_opacity));
+    for (int k = 1; k < m; k++) {
+        const double extinction = -std::log(1.0 - std::clamp(opacities[k], 0.0f, max_opacity));
+        integral[k] = integral[k - 1] + 0.5 * (previous + extinction);
+        previous = extinction;
+    }
+
+    #pragma omp parallel for
+    for (int b = 0; b < n; b++) {
+        for (int f = 0; f < n; f++) {
+            const int kf = f * subdivisions;
+            const int kb = b * subdivisions;
+            dst[(size_t) b * n + f] = f == b
+                    ? std::clamp(opacities[kf], 0.0f, 1.0f)
+                    : (float) (1.0 - std::exp(-(integral[kb] - integral[kf]) / (kb - kf)));
+        }
+    }
+}
+
+
+/*!
+ * \brief Opacity given by the colour and segment TFs to a run of voxels.
+ * \param pixels Input, straight RGBA bytes with the material id in alpha.
+ * \param dst Output, \p n opacities.
+ *
+ * A voxel is within a pick if its squared distance from the centre is at
+ * most the squared radius, as in the shader.
+ */
+static void classify_pixels(const VolumeClassifier& tfs, const uint32_t *pixels, float *dst, int n)
+{
+    int i = 0;
+#ifdef __SSE2__
+    // 4 voxels per iteration; colour differences and their squares are
+    // exact in single precision
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (; i + 4 <= n; i += 4) {
+        const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i));
+        const __m128 r = _mm_cvtepi32_ps(_mm_and_si128(p, mask));
+        const __m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 8), mask));
+        const __m128 b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 16), mask));
+        __m128 opacity = one;
+        for (const ColorTFSphere& s : tfs.color_tfs) {
+            const __m128 dr = _mm_sub_ps(r, _mm_set1_ps(s.x));
+            const __m128 dg = _mm_sub_ps(g, _mm_set1_ps(s.y));
+            const __m128 db = _mm_sub_ps(b, _mm_set1_ps(s.z));
+            const __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+            const __m128 inside = _mm_cmple_ps(d2, _mm_set1_ps(s.radius_2));
+            // the pick's opacity inside its radius, 1 outside
+            opacity = _mm_mul_ps(opacity, _mm_or_ps(_mm_and_ps(inside, _mm_set1_ps(s.opacity)),
+                                                    _mm_andnot_ps(inside, one)));
+        }
+        _mm_storeu_ps(dst + i, opacity);
+    }
+#endif
+    for (; i < n; i++) {
+        const int r = pixels[i] & 0xff;
+        const int g = (pixels[i] >> 8) & 0xff;
+        const int b = (pixels[i] >> 16) & 0xff;
+        float opacity = 1.0f;
+        for (const ColorTFSphere& s : tfs.color_tfs) {
+            const int dr = r - s.x, dg = g - s.y, db = b - s.z;
+            if (dr * dr + dg * dg + db * db <= s.radius_2) {
+                opacity *= s.opacity;
+            }
+        }
+        dst[i] = opacity;
+    }
+
+    for (i = 0; i < n; i++) {
+        dst[i] *= tfs.segment_opacities[pixels[i] >> 24];
+    }
+}
+
+
+/*!
+ * \brief Evaluate every TF for each voxel of a ring buffer volume.
+ * \param tfs TFs to apply; polygon edge tables are rebuilt.
+ * \param pixels Input, one slice of the ring, texture_width x texture_height;
+ * every slice of the volume holds the same image.
+ * \param ring Layout of the ring.
+ * \param dst Output, opacity of each voxel as 8 bit fixed point, laid out
+ * like the ring and indexed [slice][row][column].
+ * \param cancelled If given and set, stops early, leaving \p dst partly
+ * written.
+ *
+ * The opacity is the product of the colour, segment and location TFs, at
+ * the voxel centres in volume coordinates. Texels of the ring outside the
+ * region are classified as if the region extended over them, so that
+ * filtering at its edges matches the volume texture.
+ */
+void classify_volume(VolumeClassifier& tfs, const uint32_t *pixels, const RingLayout& ring,
+                     uint8_t *dst, const std::atomic<bool> *cancelled)
+{
+    const int tw = ring.texture_width;
+    const int th = ring.texture_height;
+    const int mw = tfs.mask_width;
+    const int mh = tfs.mask_height;
+    const int layers = tfs.layer_depths.size();
+
+    // colour and segment TFs only depend on the image
+    std::vector<float> image((size_t) tw * th);
+    #pragma omp parallel for
+    for (int j = 0; j < th; j++) {
+        classify_pixels(tfs, &pixels[(size_t) j * tw], &image[(size_t) j * tw], tw);
+    }
+
+    std::vector<uint8_t> mask((size_t) 2 * mw * mh * layers);
+    if (!tfs.polygons.empty()) {
+        bake_polygon_mask(tfs.polygons, tfs.polygon_layers, mw, mh, mask.data(),
+                          TFBox {0, 0, 0, mw, mh, layers}, cancelled);
+    }
+
+    // nearest mask texel of each column, -1 past the mask
+    std::vector<int> mask_column(tw);
+    for (int i = 0; i < tw; i++) {
+        const int column = (int) ((i + 0.5) * mw / ring.width);
+        mask_column[i] = column < mw ? column : -1;
+    }
+
+    // voxel rows in region order, stored at their wrapped position in the ring
+    const int x = ((ring.x % tw) + tw) % tw;
+    #pragma omp parallel
+    {
+        std::vector<float> row(tw);
+        std::vector<uint8_t> covered(tw);
+        #pragma omp for schedule(static)
+        for (int r = 0; r < ring.depth * th; r++) {
+            if (cancelled && *cancelled) {
+                continue;
+            }
+            const int k = r / th;
+            const int j = r % th;
+            const float pz = (k + 0.5f) / ring.depth;
+            const float py = (j + 0.5f) / ring.height;
+            std::fill(row.begin(), row.end(), 1.0f);
+            std::fill(covered.begin(), covered.end(), 0);
+
+            const int mask_row = (int) ((j + 0.5) * mh / ring.height);
+            for (int l = 0; l < layers && mask_row < mh; l++) {
+                if (pz < tfs.layer_depths[l].x() || pz > tfs.layer_depths[l].y()) {
+                    continue;
+                }
+                const uint8_t *texels = &mask[(size_t) 2 * (((size_t) l * mh + mask_row) * mw)];
+                for (int i = 0; i < tw; i++) {
+                    const int c = mask_column[i];
+                    if (c >= 0 && texels[2 * c + 1] > 127) {
+                        row[i] *= texels[2 * c] / 255.0f;
+                        covered[i] = 1;
+                    }
+                }
+            }
+
+            for (size_t p = 0; p < tfs.planes.size(); p++) {
+                // dot(normal, position) along the row, position.x = (i + 0.5) / width
+                const QVector4D& e = tfs.planes[p];
+                const float slope = e.x() / ring.width;
+                const float base = e.x() * 0.5f / ring.width + e.y() * py + e.z() * pz;
+                const float opacity = tfs.plane_opacities[p];
+                for (int i = 0; i < tw; i++) {
+                    if (slope * i + base <= e.w()) {
+                        row[i] *= opacity;
+                        covered[i] = 1;
+                    }
+                }
+            }
+
+            const int ty = (((j + ring.y) % th) + th) % th;
+            const float *colour = &image[(size_t) ty * tw];
+            // region column i is ring column (i + x) % tw
+            for (int i = 0; i < tw; i++) {
+                row[i] = covered[i] ? row[i] : tfs.volume_opacity;
+            }
+            for (int i = 0; i < tw - x; i++) {
+                row[i] *= colour[i + x];
+            }
+            for (int i = tw - x; i < tw; i++) {
+                row[i] *= colour[i + x - tw];
+            }
+
+            uint8_t *out = &dst[((size_t) k * th + ty) * tw];
+            pack_unorm8(row.data(), out + x, tw - x);
+            pack_unorm8(row.data() + tw - x, out, x);
+        }
+    }
+}
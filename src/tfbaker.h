@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <QColor>
+#include <QVector2D>
+#include <QVector4D>
+
+#include "polygon.h"
+
+struct ColorTF {
+    int id;
+    QRgb rgb;
+    int proximity_radius;
+    float opacity;
+};
+
+// box of TF cells, [x0, x1) x [y0, y1) x [z0, z1)
+struct TFBox {
+    int x0, y0, z0;
+    int x1, y1, z1;
+
+    bool empty() const { return x0 >= x1 || y0 >= y1 || z0 >= z1; }
+    TFBox united(const TFBox& other) const;
+    TFBox intersected(const TFBox& other) const;
+    bool contains(const TFBox& other) const;
+};
+
+void pack_unorm8(const float *src, uint8_t *dst, int n);
+void pack_rg8(const float *opacity, const uint8_t *coverage, uint8_t *dst, int n);
+
+// colour pick in TF cell units: a cell is within it if its squared distance
+// from the centre is at most radius_2. Plain 4 byte fields, so an array
+// matches a std430 shader storage block.
+struct ColorTFSphere {
+    int x, y, z;
+    int radius_2;
+    float opacity;
+};
+
+TFBox color_tf_footprint(const ColorTF& tf, int n);
+std::vector<ColorTFSphere> color_tf_spheres(const std::vector<ColorTF>& tfs, int n);
+
+void bake_color_proximity_tf(const std::vector<ColorTF>& tfs, int n, uint8_t *dst);
+void bake_color_proximity_tf(const std::vector<ColorTF>& tfs, int n, uint8_t *dst, const TFBox& box,
+                             const std::atomic<bool> *cancelled = nullptr,
+                             const uint8_t *occupied = nullptr);
+
+void bake_polygon_mask(std::vector<Polygon>& polygons, const std::vector<int>& layers,
+                       int width, int height, uint8_t *dst, const TFBox& box,
+                       const std::atomic<bool> *cancelled = nullptr);
+
+void bake_preintegrated_tf(const float *opacities, int n, int subdivisions, float *dst);
+
+// every TF, in the form classify_volume() evaluates them per voxel
+struct VolumeClassifier {
+    std::vector<ColorTFSphere> color_tfs;   // in 0-255 colour units
+    float segment_opacities[256];           // by material id (volume alpha)
+    std::vector<Polygon> polygons;
+    std::vector<int> polygon_layers;
+    std::vector<QVector2D> layer_depths;
+    int mask_width, mask_height;            // resolution polygons are rasterised at
+    std::vector<QVector4D> planes;          // hiding dot(xyz, p) <= w
+    std::vector<float> plane_opacities;
+    float volume_opacity;                   // where no polygon or plane applies
+};
+
+// layout of a ring buffer volume texture: region origin in the ring, region
+// and texture size, in voxels
+struct RingLayout {
+    int x, y;
+    int width, height, depth;
+    int texture_width, texture_height;
+};
+
+void classify_volume(VolumeClassifier& tfs, const uint32_t *pixels, const RingLayout& ring,
+                     uint8_t *dst, const std::atomic<bool> *cancelled = nullptr);
@@ -0,0 +1,144 @@
+#include "tfcache.h"
+
+#include <algorithm>
+
+#include <QOpenGLContext>
+
+
+/*!
+ * \brief Constructor.
+ * \param budget Upper bound for the size of the cached textures, in bytes.
+ */
+TFCache::TFCache(size_t budget)
+    : m_budget {budget}
+{
+    initializeOpenGLFunctions();
+}
+
+
+/*!
+ * \brief Destructor.
+ */
+TFCache::~TFCache()
+{
+    if (!QOpenGLContext::currentContext()) {
+        return;
+    }
+    for (Entry& entry : m_entries) {
+        glDeleteTextures(1, &entry.texture);
+    }
+}
+
+
+/*!
+ * \brief Change the budget, evicting entries that no longer fit.
+ */
+void TFCache::set_budget(size_t budget)
+{
+    m_budget = budget;
+    evict();
+}
+
+
+/*!
+ * \brief Keep a copy of the most recent contents of a TF texture.
+ * \param key Hash of the TF parameters the texture was baked from.
+ * \param texture TF texture; its latest() texture is copied.
+ * \param bytes Size of the texture.
+ */
+void TFCache::store(uint64_t key, TextureStream& texture, GLenum target, GLint internal_format,
+                    int width, int height, int depth, size_t bytes)
+{
+    auto it = std::find_if(m_entries.begin(), m_entries.end(), [key](const Entry& e) { return e.key == key; });
+    if (it != m_entries.end()) {
+        m_entries.splice(m_entries.begin(), m_entries, it);
+        return;
+    }
+    if (bytes > m_budget || texture.latest() == 0) {
+        return;
+    }
+
+    Entry entry {key, 0, target, internal_format, width, height, depth, bytes};
+    glGenTextures(1, &entry.texture);
+    glBindTexture(target, entry.texture);
+    if (target == GL_TEXTURE_2D) {
+        glTexStorage2D(target, 1, internal_format, width, height);
+    }
+    else {
+        glTexStorage3D(target, 1, internal_format, width, height, depth);
+    }
+    glBindTexture(target, 0);
+    glCopyImageSubData(texture.latest(), target, 0, 0, 0, 0,
+                       entry.texture, target, 0, 0, 0, 0, width, height, depth);
+
+    m_entries.push_front(entry);
+    m_bytes += bytes;
+    evict();
+}
+
+
+/*!
+ * \brief Replace a TF texture with a cached copy.
+ * \param key Hash of the TF parameters to be shown.
+ * \return Whether the key was cached.
+ *
+ * The copy goes through a full upload of \p texture, so it swaps in like
+ * any other new texture.
+ */
+bool TFCache::restore(uint64_t key, TextureStream& texture)
+{
+    auto it = std::find_if(m_entries.begin(), m_entries.end(), [key](const Entry& e) { return e.key == key; });
+    if (it == m_entries.end()) {
+        return false;
+    }
+    m_entries.splice(m_entries.begin(), m_entries, it);
+
+    const Entry& entry = m_entries.front();
+    texture.begin(entry.internal_format, entry.width, entry.height, entry.depth);
+    glCopyImageSubData(entry.texture, entry.target, 0, 0, 0, 0,
+                       texture.back(), entry.target, 0, 0, 0, 0, entry.width, entry.height, entry.depth);
+    texture.end();
+    return true;
+}
+
+
+/*!
+ * \brief Store a TF texture later, at the next store_deferred(), unless
+ * another is deferred before.
+ *
+ * The texture is copied when it is stored, so it must still hold the TF
+ * \p key was hashed from, or the deferred store be cancelled.
+ */
+void TFCache::defer_store(uint64_t key, TextureStream& texture, GLenum target, GLint internal_format,
+                          int width, int height, int depth, size_t bytes)
+{
+    m_deferred = Deferred {key, &texture, target, internal_format, width, height, depth, bytes};
+}
+
+
+/*!
+ * \brief Store the texture deferred last, if any.
+ */
+void TFCache::store_deferred()
+{
+    if (!m_deferred.texture) {
+        return;
+    }
+    const Deferred d = m_deferred;
+    m_deferred.texture = nullptr;
+    store(d.key, *d.texture, d.target, d.internal_format, d.width, d.height, d.depth, d.bytes);
+}
+
+
+/*!
+ * \brief Drop least recently used entries until the cache fits its budget.
+ */
+void TFCache::evict()
+{
+    while (m_bytes > m_budget && !m_entries.empty()) {
+        Entry& entry = m_entries.back();
+        glDeleteTextures(1, &entry.texture);
+        m_bytes -= entry.bytes;
+        m_entries.pop_back();
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+
+#include <QOpenGLExtraFunctions>
+
+#include "texturestream.h"
+
+/*!
+ * \brief FNV-1a hash of a block of memory, for building TF cache keys.
+ * \param seed Hash of the preceding blocks, to chain several calls.
+ */
+inline uint64_t hash_bytes(const void *data, size_t size, uint64_t seed = 14695981039346656037ull)
+{
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        seed = (seed ^ bytes[i]) * 1099511628211ull;
+    }
+    return seed;
+}
+
+/*!
+ * \brief Bounded cache of baked TF textures, keyed by a hash of the TF
+ * parameters.
+ *
+ * Users tend to toggle between a few TF states; restoring one of them is a
+ * texture copy on the GPU instead of a bake and an upload. Entries are
+ * evicted least recently used first, once the textures exceed the budget.
+ *
+ * TFs baked while they are being edited can be deferred instead: only the
+ * last one deferred is stored, once the edits have settled, so that the
+ * states a slider passes through do not push useful entries out.
+ *
+ * Requires a current OpenGL context for all calls, including construction.
+ */
+class TFCache : protected QOpenGLExtraFunctions
+{
+public:
+    explicit TFCache(size_t budget);
+    virtual ~TFCache();
+
+    TFCache(const TFCache&) = delete;
+    TFCache& operator=(const TFCache&) = delete;
+
+    void set_budget(size_t budget);
+
+    void store(uint64_t key, TextureStream& texture, GLenum target, GLint internal_format,
+               int width, int height, int depth, size_t bytes);
+    bool restore(uint64_t key, TextureStream& texture);
+
+    void defer_store(uint64_t key, TextureStream& texture, GLenum target, GLint internal_format,
+                     int width, int height, int depth, size_t bytes);
+    void store_deferred();
+
+    /*!
+     * \brief Forget the deferred texture, e.g. once it has been replaced.
+     */
+    void cancel_deferred() { m_deferred.texture = nullptr; }
+
+private:
+    struct Entry {
+        uint64_t key;
+        GLuint texture;
+        GLenum target;
+        GLint internal_format;
+        int width, height, depth;
+        size_t bytes;
+    };
+
+    struct Deferred {
+        uint64_t key;
+        TextureStream *texture {nullptr};   /*!< Null if nothing is deferred. */
+        GLenum target;
+        GLint internal_format;
+        int width, height, depth;
+        size_t bytes;
+    };
+
+    std::list<Entry> m_entries;     /*!< Most recently used first. */
+    Deferred m_deferred;
+    size_t m_bytes {0};
+    size_t m_budget;
+
+    void evict();
+};
@@ -0,0 +1,100 @@
+#include "tfcompute.h"
+
+#include <algorithm>
+
+#include <QOpenGLContext>
+
+// work group size of the bake shaders along each axis
+static const int GROUP_SIZE = 8;
+
+
+/*!
+ * \brief Whether TFs are to be baked on the GPU, if the context allows it.
+ */
+bool TFCompute::enabled()
+{
+    const QOpenGLContext *context = QOpenGLContext::currentContext();
+    return qEnvironmentVariableIntValue("RAYCASTER_GPU_TF_BAKING") != 0
+            && context && !context->isOpenGLES()
+            && context->format().version() >= qMakePair(4, 3);
+}
+
+
+/*!
+ * \brief Constructor, compiles the bake shaders.
+ */
+TFCompute::TFCompute()
+{
+    initializeOpenGLFunctions();
+    glGenBuffers(1, &m_spheres);
+
+    if (!m_color_tf_program.addShaderFromSourceFile(QOpenGLShader::Compute, ":/shaders/color_tf.comp")
+            || !m_color_tf_program.link()) {
+        qWarning("TFCompute: cannot build the colour TF shader, baking on the CPU");
+    }
+}
+
+
+/*!
+ * \brief Destructor.
+ */
+TFCompute::~TFCompute()
+{
+    if (!QOpenGLContext::currentContext()) {
+        return;
+    }
+    glDeleteBuffers(1, &m_spheres);
+}
+
+
+/*!
+ * \brief Bake a box of the colour proximity TF into its texture.
+ * \param tfs Colour picks, see ::bake_color_proximity_tf().
+ * \param n Size of the TF along each axis of the RGB cube.
+ * \param texture TF texture. If it holds nothing yet, or a TF of another
+ * size, the whole TF is baked into a new texture.
+ * \param box Cells to be recomputed.
+ */
+void TFCompute::bake_color_proximity_tf(const std::vector<ColorTF>& tfs, int n,
+                                        TextureStream& texture, const TFBox& box)
+{
+    const bool full = !texture.valid() || n != m_color_tf_dimension;
+    const TFBox cells = full ? TFBox {0, 0, 0, n, n, n} : box;
+    if (cells.empty()) {
+        return;
+    }
+    if (full) {
+        texture.begin(GL_R8, n, n, n);
+    }
+
+    const std::vector<ColorTFSphere> spheres = color_tf_spheres(tfs, n);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_spheres);
+    // an empty buffer store cannot be bound, keep at least one element
+    glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(1, spheres.size()) * sizeof(ColorTFSphere),
+                 spheres.empty() ? nullptr : spheres.data(), GL_STREAM_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_spheres);
+
+    m_color_tf_program.bind();
+    m_color_tf_program.setUniformValue("sphere_count", (GLint) spheres.size());
+    const int origin[3] = {cells.x0, cells.y0, cells.z0};
+    const int size[3] = {cells.x1 - cells.x0, cells.y1 - cells.y0, cells.z1 - cells.z0};
+    glUniform3iv(m_color_tf_program.uniformLocation("box_origin"), 1, origin);
+    glUniform3iv(m_color_tf_program.uniformLocation("box_size"), 1, size);
+
+    glBindImageTexture(0, full ? texture.back() : texture.latest(), 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R8);
+    glDispatchCompute((size[0] + GROUP_SIZE - 1) / GROUP_SIZE,
+                      (size[1] + GROUP_SIZE - 1) / GROUP_SIZE,
+                      (size[2] + GROUP_SIZE - 1) / GROUP_SIZE);
+    // the raycaster samples the texture next
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+    glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R8);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    m_color_tf_program.release();
+
+    if (full) {
+        texture.end();
+        m_color_tf_dimension = n;
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+
+#include "texturestream.h"
+#include "tfbaker.h"
+
+/*!
+ * \brief Bakes TFs with compute shaders, straight into their textures.
+ *
+ * An alternative to baking on the CPU and uploading the result: nothing
+ * crosses the bus but the TF parameters. The output is identical to the CPU
+ * bake. Requires OpenGL 4.3, which Mesa's llvmpipe provides too, so the path
+ * also runs on hosts without a GPU.
+ *
+ * Disabled unless the RAYCASTER_GPU_TF_BAKING environment variable is set to
+ * a non-zero value. Requires a current OpenGL context for all calls.
+ */
+class TFCompute : protected QOpenGLExtraFunctions
+{
+public:
+    static bool enabled();
+
+    TFCompute();
+    virtual ~TFCompute();
+
+    TFCompute(const TFCompute&) = delete;
+    TFCompute& operator=(const TFCompute&) = delete;
+
+    /*!
+     * \brief Whether the shaders compiled, i.e. bakes can be issued.
+     */
+    bool valid() { return m_color_tf_program.isLinked(); }
+
+    void bake_color_proximity_tf(const std::vector<ColorTF>& tfs, int n,
+                                 TextureStream& texture, const TFBox& box);
+
+private:
+    QOpenGLShaderProgram m_color_tf_program;
+    GLuint m_spheres {0};   /*!< Shader storage buffer for the colour picks. */
+    int m_color_tf_dimension {0};   /*!< Size of the last full colour TF bake. */
+};
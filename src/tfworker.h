@@ -0,0 +1,183 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "tfbaker.h"
+
+/*!
+ * \brief Bakes a TF on a background thread, into a buffer of its own.
+ *
+ * The GL thread submits jobs, and collects the result once per frame to
+ * upload it; until then the canvas keeps drawing the previous texture. Only
+ * the latest job matters: submitting cancels the job in flight and replaces
+ * any queued one. Cells a cancelled job left half written are added to the
+ * next job, and each upload covers everything baked since the previous one.
+ * A job only publishes its result if nothing was submitted or cancelled
+ * since it started.
+ *
+ * \p Buffer holds the baked TF and anything its upload needs, and is only
+ * touched by the worker and, through collect(), by the GL thread.
+ */
+template <class Buffer>
+class TFWorker
+{
+public:
+    /*!
+     * \brief Bake function: recomputes at least \p box of the buffer and
+     * returns the cells it wrote, e.g. the whole TF when its layout changed.
+     * It should poll \p cancelled and return early once it is set.
+     */
+    using Job = std::function<TFBox(Buffer& buffer, const TFBox& box, const std::atomic<bool>& cancelled)>;
+
+    TFWorker()
+        : m_thread {&TFWorker::run, this}
+    {
+    }
+
+    ~TFWorker()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+            m_cancelled = true;
+        }
+        m_wake.notify_one();
+        m_thread.join();
+    }
+
+    TFWorker(const TFWorker&) = delete;
+    TFWorker& operator=(const TFWorker&) = delete;
+
+    /*!
+     * \brief Queue a job, cancelling the one running.
+     * \param box Cells to recompute. Cells left unfinished by cancelled jobs
+     * are added to it.
+     * \param job Bake function, holding its own copy of the TF parameters.
+     */
+    void submit(const TFBox& box, Job job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_job = std::move(job);
+            m_job_box = box;
+            m_cancelled = true;
+            m_generation++;
+        }
+        m_wake.notify_one();
+    }
+
+    /*!
+     * \brief Cancel the running job, and drop the queued one and any result
+     * not collected yet.
+     *
+     * For when the TF is replaced by other means: the buffer no longer
+     * matches it, and the next job should bake the whole TF.
+     */
+    void cancel()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_job = nullptr;
+        m_cancelled = true;
+        m_generation++;
+        m_ready = false;
+    }
+
+    /*!
+     * \brief Whether a job is queued or running, or a result waits to be
+     * collected.
+     */
+    bool busy()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_job || m_running || m_ready;
+    }
+
+    /*!
+     * \brief Whether a job is queued or running, i.e. a result newer than
+     * the one collected may follow.
+     */
+    bool pending()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_job || m_running;
+    }
+
+    /*!
+     * \brief Hand the latest result to \p upload, if there is one.
+     * \param upload Called with the buffer and the cells changed since the
+     * previous result.
+     * \return Whether a result was collected.
+     *
+     * Never waits for the worker: while a job is writing the buffer, the
+     * result is left for a later frame.
+     */
+    bool collect(const std::function<void(const Buffer&, const TFBox&)>& upload)
+    {
+        std::unique_lock<std::mutex> buffer_lock(m_buffer_mutex, std::try_to_lock);
+        if (!buffer_lock.owns_lock() || !m_ready) {
+            return false;
+        }
+        upload(m_buffer, m_baked);
+        m_baked = TFBox {0, 0, 0, 0, 0, 0};
+        m_ready = false;
+        return true;
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;) {
+            m_wake.wait(lock, [this] { return m_quit || m_job; });
+            if (m_quit) {
+                return;
+            }
+            Job job = std::move(m_job);
+            const TFBox box = m_job_box.united(m_unfinished);
+            const uint64_t generation = m_generation;
+            m_job = nullptr;
+            m_cancelled = false;
+            m_running = true;
+            lock.unlock();
+
+            // the buffer stays locked while it is written, so collect()
+            // cannot upload half a bake
+            std::unique_lock<std::mutex> buffer_lock(m_buffer_mutex);
+            m_ready = false;
+            const TFBox written = job(m_buffer, box, m_cancelled);
+
+            // decided under the queue lock, so that a submit() or cancel()
+            // made at any point since the job started discards its result
+            lock.lock();
+            const bool current = generation == m_generation;
+            m_baked = m_baked.united(written);
+            m_unfinished = current ? TFBox {0, 0, 0, 0, 0, 0} : written;
+            m_ready = current;
+            buffer_lock.unlock();
+            m_running = false;
+        }
+    }
+
+    std::mutex m_mutex;                 /*!< Guards the job queue. */
+    std::condition_variable m_wake;
+    Job m_job;                          /*!< Next job, empty if none. */
+    TFBox m_job_box {0, 0, 0, 0, 0, 0};
+    bool m_running {false};
+    bool m_quit {false};
+    std::atomic<bool> m_cancelled {false};
+    uint64_t m_generation {0};          /*!< Counts submit() and cancel() calls. */
+
+    std::mutex m_buffer_mutex;          /*!< Held while the buffer is written or uploaded. */
+    Buffer m_buffer;
+    TFBox m_baked {0, 0, 0, 0, 0, 0};   /*!< Cells changed since the last collected result. */
+    TFBox m_unfinished {0, 0, 0, 0, 0, 0};  /*!< Cells of the last job, if it was cancelled. */
+    std::atomic<bool> m_ready {false};
+
+    // started last, once the members above are initialised
+    std::thread m_thread;
+};
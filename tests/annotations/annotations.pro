@@ -0,0 +1,19 @@
+QT       += testlib
+QT       -= gui
+
+TARGET = tst_annotations
+CONFIG += testcase console
+CONFIG -= app_bundle
+
+gcc:QMAKE_CXXFLAGS += -std=c++17
+
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_annotations.cpp \
+    ../../src/annotations.cpp \
+    ../../src/polygon.cpp \
+
+HEADERS += \
+    ../../src/annotations.h \
+    ../../src/polygon.h \
@@ -0,0 +1,132 @@
+#include <QtTest>
+
+#include <QTemporaryDir>
+
+#include "annotations.h"
+#include "polygon.h"
+
+/*!
+ * \brief Checks that imported annotations fill the area of every ring, and
+ * nothing between them.
+ */
+class TestAnnotations : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void multi_polygon();
+    void polygon_with_holes();
+    void asap();
+
+private:
+    std::vector<Annotation> load(const QString& name, const QByteArray& contents);
+    static Polygon polygon(const Annotation& annotation);
+
+    QTemporaryDir m_dir;
+};
+
+/*!
+ * \brief Write \p contents to a file called \p name, and read it back.
+ */
+std::vector<Annotation> TestAnnotations::load(const QString& name, const QByteArray& contents)
+{
+    const QString path = m_dir.filePath(name);
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(contents) != contents.size())
+        return {};
+    file.close();
+    return load_annotations(path);
+}
+
+/*!
+ * \brief The outline of \p annotation, as the location TF fills it.
+ */
+Polygon TestAnnotations::polygon(const Annotation& annotation)
+{
+    std::vector<QVector3D> vertices;
+    for (const QPointF& p : annotation.vertices)
+        vertices.push_back(QVector3D(p.x(), p.y(), 0.0f));
+    Polygon polygon;
+    polygon.set_vertices(0, std::move(vertices));
+    return polygon;
+}
+
+void TestAnnotations::multi_polygon()
+{
+    // three unit squares, apart from each other
+    const std::vector<Annotation> annotations = load("three.geojson", R"({
+        "type": "Feature",
+        "properties": {"name": "three"},
+        "geometry": {"type": "MultiPolygon", "coordinates": [
+            [[[0, 0], [1, 0], [1, 1], [0, 1], [0, 0]]],
+            [[[4, 0], [5, 0], [5, 1], [4, 1], [4, 0]]],
+            [[[2, 3], [3, 3], [3, 4], [2, 4], [2, 3]]]
+        ]}
+    })");
+    QCOMPARE(annotations.size(), (size_t) 1);
+    QCOMPARE(annotations[0].name, QString("three"));
+
+    Polygon p = polygon(annotations[0]);
+    QVERIFY(p.point_is_inside(0.5f, 0.5f));
+    QVERIFY(p.point_is_inside(4.5f, 0.5f));
+    QVERIFY(p.point_is_inside(2.5f, 3.5f));
+    // between the parts
+    QVERIFY(!p.point_is_inside(2.7f, 2.0f));
+    QVERIFY(!p.point_is_inside(2.5f, 0.5f));
+    QVERIFY(!p.point_is_inside(1.5f, 1.5f));
+    QVERIFY(!p.point_is_inside(3.5f, 2.0f));
+}
+
+void TestAnnotations::polygon_with_holes()
+{
+    // unclosed rings, as some exports write them
+    const std::vector<Annotation> annotations = load("holes.geojson", R"({
+        "type": "FeatureCollection",
+        "features": [{
+            "type": "Feature",
+            "properties": {"classification": {"name": "Tumor"}},
+            "geometry": {"type": "Polygon", "coordinates": [
+                [[0, 0], [10, 0], [10, 10], [0, 10]],
+                [[2, 2], [3, 2], [3, 3], [2, 3]],
+                [[6, 6], [7, 6], [7, 7], [6, 7]]
+            ]}
+        }]
+    })");
+    QCOMPARE(annotations.size(), (size_t) 1);
+    QCOMPARE(annotations[0].group, QString("Tumor"));
+
+    Polygon p = polygon(annotations[0]);
+    QVERIFY(!p.point_is_inside(2.5f, 2.5f));
+    QVERIFY(!p.point_is_inside(6.5f, 6.5f));
+    QVERIFY(p.point_is_inside(5.0f, 5.0f));
+    QVERIFY(p.point_is_inside(4.5f, 2.5f));
+    QVERIFY(p.point_is_inside(1.0f, 9.0f));
+    QVERIFY(!p.point_is_inside(11.0f, 5.0f));
+}
+
+void TestAnnotations::asap()
+{
+    // coordinates out of order, and a dot that encloses nothing
+    const std::vector<Annotation> annotations = load("asap.xml", R"(<?xml version="1.0"?>
+        <ASAP_Annotations><Annotations>
+            <Annotation Name="square" Type="Polygon" PartOfGroup="None"><Coordinates>
+                <Coordinate Order="2" X="2" Y="2"/>
+                <Coordinate Order="0" X="0" Y="0"/>
+                <Coordinate Order="3" X="0" Y="2"/>
+                <Coordinate Order="1" X="2" Y="0"/>
+            </Coordinates></Annotation>
+            <Annotation Name="dot" Type="Dot" PartOfGroup="None"><Coordinates>
+                <Coordinate Order="0" X="5" Y="5"/>
+            </Coordinates></Annotation>
+        </Annotations></ASAP_Annotations>)");
+    QCOMPARE(annotations.size(), (size_t) 1);
+    QCOMPARE(annotations[0].name, QString("square"));
+
+    Polygon p = polygon(annotations[0]);
+    QVERIFY(p.point_is_inside(1.0f, 1.0f));
+    QVERIFY(!p.point_is_inside(3.0f, 1.0f));
+}
+
+QTEST_APPLESS_MAIN(TestAnnotations)
+
+#include "tst_annotations.moc"
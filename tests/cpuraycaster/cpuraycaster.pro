@@ -0,0 +1,24 @@
+QT       += testlib
+
+TARGET = tst_cpuraycaster
+CONFIG += testcase console
+CONFIG -= app_bundle
+
+gcc:QMAKE_CXXFLAGS += -std=c++17 -fopenmp
+gcc:LIBS += -fopenmp
+
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_cpuraycaster.cpp \
+    ../../src/coloroccupancy.cpp \
+    ../../src/cpuraycaster.cpp \
+    ../../src/polygon.cpp \
+    ../../src/tfbaker.cpp \
+
+HEADERS += \
+    ../../src/coloroccupancy.h \
+    ../../src/cpuraycaster.h \
+    ../../src/polygon.h \
+    ../../src/raycastview.h \
+    ../../src/tfbaker.h \
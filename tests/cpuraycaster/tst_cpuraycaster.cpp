@@ -0,0 +1,231 @@
+#include <QtTest>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "cpuraycaster.h"
+
+/*!
+ * \brief Renders a small synthetic volume with CPURayCaster, sampling and
+ * pre-integrating the segment TF, and compares frames with compare_images().
+ */
+class TestCPURayCaster : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void compare();
+    void transparent();
+    void neutral_tfs();
+    void preintegrated();
+    void no_volume();
+
+private:
+    static const int WIDTH = 64;
+    static const int HEIGHT = 48;
+
+    static CPURayCastVolume volume(const float segment_opacities[3]);
+    static void preintegrate(CPURayCastVolume& volume);
+    static std::vector<uint8_t> render(const CPURayCastVolume& volume, float step_length);
+    static bool covers(const std::vector<uint8_t>& image);
+};
+
+/*!
+ * \brief Volume of 96 x 80 x 32 voxels, at an offset in a 128 x 128 ring so
+ * that it wraps: a grid of cells, each of three nested materials, over a
+ * colour ramp.
+ */
+CPURayCastVolume TestCPURayCaster::volume(const float segment_opacities[3])
+{
+    const RingLayout ring {100, 40, 96, 80, 32, 128, 128};
+    auto pixels = std::make_shared<std::vector<uint32_t>>((size_t) ring.texture_width * ring.texture_height);
+    for (int y = 0; y < ring.texture_height; y++) {
+        for (int x = 0; x < ring.texture_width; x++) {
+            const float r = std::hypot(x % 12 - 6.0f, y % 12 - 6.0f);
+            const uint32_t material = r < 3.5f ? 253 : (r < 5.0f ? 254 : 255);
+            const uint32_t blue = material == 253 ? 80 : (material == 254 ? 200 : 240);
+            (*pixels)[y * ring.texture_width + x] = ((x * 2) & 255) | (((y * 2) & 255) << 8) | (blue << 16) | (material << 24);
+        }
+    }
+
+    CPURayCastVolume volume;
+    volume.pixels = pixels;
+    volume.layout = ring;
+    volume.levels = 5;
+    QVector3D extent(ring.width, ring.height, ring.depth);
+    extent /= std::max({extent.x(), extent.y(), extent.z()});
+    volume.top = extent / 2.0f;
+    volume.bottom = -extent / 2.0f;
+    std::copy(segment_opacities, segment_opacities + 3, volume.segment_opacities);
+    volume.location_tfs.mask_width = 1;
+    volume.location_tfs.mask_height = 1;
+    volume.location_tfs.volume_opacity = 1.0f;
+    return volume;
+}
+
+/*!
+ * \brief Bake the pre-integrated table of the segment TF, as RayCastVolume
+ * does, and switch to it.
+ */
+void TestCPURayCaster::preintegrate(CPURayCastVolume& volume)
+{
+    const int n = 256, subdivisions = 16;
+    const int samples = (n - 1) * subdivisions + 1;
+    std::vector<float> opacities(samples);
+    for (int k = 0; k < samples; k++) {
+        // the segment TF texture, sampled linearly
+        const float u = 256.0f - k / (float) (samples - 1) * 256.0f - 0.5f;
+        const int i = std::floor(u);
+        const float a = volume.segment_opacities[std::clamp(i, 0, 2)];
+        const float b = volume.segment_opacities[std::clamp(i + 1, 0, 2)];
+        opacities[k] = a + (b - a) * (u - i);
+    }
+    volume.preintegrated_tf.resize((size_t) n * n);
+    bake_preintegrated_tf(opacities.data(), n, subdivisions, volume.preintegrated_tf.data());
+    volume.preintegrated = true;
+}
+
+/*!
+ * \brief Render the volume from an oblique angle, so that rays cross
+ * several cells and the ring's wrap.
+ */
+std::vector<uint8_t> TestCPURayCaster::render(const CPURayCastVolume& volume, float step_length)
+{
+    QMatrix4x4 model_matrix;
+    model_matrix.scale(0.5f * (volume.top - volume.bottom));
+
+    RayCastView view;
+    view.step_length = step_length;
+    view.light_position = QVector3D(3.0f, 2.0f, 3.0f);
+    view.set_camera(QQuaternion::fromAxisAndAngle(1.0f, 0.0f, 0.0f, 30.0f) * QQuaternion::fromAxisAndAngle(0.0f, 1.0f, 0.0f, 40.0f),
+                    -600.0f, model_matrix, WIDTH, HEIGHT);
+
+    std::vector<uint8_t> image((size_t) 4 * WIDTH * HEIGHT);
+    CPURayCaster(volume).render(view, WIDTH, HEIGHT, image.data());
+    return image;
+}
+
+/*!
+ * \brief Whether the volume shows, i.e. some pixel is not black. Pixels the
+ * bounding box covers take the alpha of the ray, even if nothing shows.
+ */
+bool TestCPURayCaster::covers(const std::vector<uint8_t>& image)
+{
+    for (size_t i = 0; i < image.size(); i += 4) {
+        if (image[i] || image[i + 1] || image[i + 2]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void TestCPURayCaster::compare()
+{
+    const uint8_t a[8] = {0, 10, 20, 255, 100, 100, 100, 255};
+    const uint8_t b[8] = {0, 13, 20, 255, 90, 100, 100, 0};
+
+    const ImageDifference same = compare_images(a, a, 2, 0);
+    QCOMPARE(same.max, 0);
+    QCOMPARE(same.mean, 0.0);
+    QCOMPARE(same.exceeding, (int64_t) 0);
+
+    const ImageDifference different = compare_images(a, b, 2, 5);
+    QCOMPARE(different.max, 255);
+    QCOMPARE(different.mean, (3 + 10 + 255) / 8.0);
+    QCOMPARE(different.exceeding, (int64_t) 2);
+    QCOMPARE(compare_images(a, b, 2, 255).exceeding, (int64_t) 0);
+}
+
+/*!
+ * \brief Nothing visible leaves the background colour, and hiding the
+ * volume with its location TF matches clearing the segment TF.
+ */
+void TestCPURayCaster::transparent()
+{
+    const float clear[3] = {0.0f, 0.0f, 0.0f};
+    const float opaque[3] = {0.3f, 0.6f, 0.9f};
+    for (bool preintegrated : {false, true}) {
+        CPURayCastVolume cleared = volume(clear);
+        CPURayCastVolume shown = volume(opaque);
+        if (preintegrated) {
+            preintegrate(cleared);
+            preintegrate(shown);
+        }
+        CPURayCastVolume hidden = shown;
+        hidden.location_tfs.volume_opacity = 0.0f;
+
+        const std::vector<uint8_t> background = render(cleared, 0.01f);
+        QVERIFY(!covers(background));
+        QVERIFY(covers(render(shown, 0.01f)));
+        QCOMPARE(compare_images(render(hidden, 0.01f).data(), background.data(), WIDTH * HEIGHT, 0).max, 0);
+    }
+}
+
+/*!
+ * \brief A pick and a slicing plane of opacity 1, covering the whole volume,
+ * change nothing.
+ */
+void TestCPURayCaster::neutral_tfs()
+{
+    const float opacities[3] = {0.3f, 0.6f, 0.05f};
+    for (bool preintegrated : {false, true}) {
+        CPURayCastVolume plain = volume(opacities);
+        if (preintegrated) {
+            preintegrate(plain);
+        }
+        CPURayCastVolume neutral = plain;
+        neutral.color_tfs.push_back(QVector4D(128.0f, 128.0f, 128.0f, 3.0f * 128.0f * 128.0f));
+        neutral.color_tf_opacities.push_back(1.0f);
+        neutral.location_tfs.planes.push_back(QVector4D(1.0f, 0.0f, 0.0f, 2.0f));
+        neutral.location_tfs.plane_opacities.push_back(1.0f);
+
+        const std::vector<uint8_t> expected = render(plain, 0.01f);
+        QVERIFY(covers(expected));
+        QCOMPARE(compare_images(render(neutral, 0.01f).data(), expected.data(), WIDTH * HEIGHT, 0).max, 0);
+    }
+}
+
+/*!
+ * \brief Pre-integrated frames barely depend on the step length, as the
+ * opacities are corrected for it: halving it only resolves the boundaries
+ * between materials more finely. Sampled frames, which are not corrected,
+ * change throughout. Unlit, as lighting draws opaque surfaces where the
+ * material changes between two samples, and faint, so that rays do not
+ * saturate.
+ */
+void TestCPURayCaster::preintegrated()
+{
+    const float opacities[3] = {0.02f, 0.05f, 0.01f};
+    const CPURayCastVolume plain = volume(opacities);
+    CPURayCastVolume integrated = plain;
+    preintegrate(integrated);
+    const float step_length = integrated.reference_step_length;
+
+    const std::vector<uint8_t> expected = render(integrated, step_length);
+    const ImageDifference difference = compare_images(render(integrated, step_length / 2.0f).data(),
+                                                      expected.data(), WIDTH * HEIGHT, 8);
+    const ImageDifference sampled = compare_images(render(plain, step_length / 2.0f).data(),
+                                                   render(plain, step_length).data(), WIDTH * HEIGHT, 8);
+    QVERIFY(covers(expected));
+    QVERIFY2(difference.exceeding <= 4 * WIDTH * HEIGHT / 100,
+             qPrintable(QString("%1 channels differ by more than 8").arg(difference.exceeding)));
+    QVERIFY2(4 * difference.exceeding < sampled.exceeding,
+             qPrintable(QString("%1 channels differ by more than 8, %2 without pre-integration")
+                        .arg(difference.exceeding).arg(sampled.exceeding)));
+}
+
+/*!
+ * \brief A copy taken without a volume loaded is refused.
+ */
+void TestCPURayCaster::no_volume()
+{
+    const float opacities[3] = {1.0f, 1.0f, 1.0f};
+    CPURayCastVolume empty = volume(opacities);
+    empty.pixels.reset();
+    QVERIFY_EXCEPTION_THROWN(CPURayCaster {empty}, std::runtime_error);
+}
+
+QTEST_APPLESS_MAIN(TestCPURayCaster)
+
+#include "tst_cpuraycaster.moc"
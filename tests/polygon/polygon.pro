@@ -0,0 +1,17 @@
+QT       += testlib
+QT       -= gui
+
+TARGET = tst_polygon
+CONFIG += testcase console
+CONFIG -= app_bundle
+
+gcc:QMAKE_CXXFLAGS += -std=c++17
+
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_polygon.cpp \
+    ../../src/polygon.cpp \
+
+HEADERS += \
+    ../../src/polygon.h \
@@ -0,0 +1,123 @@
+#include <QtTest>
+
+#include "polygon.h"
+
+/*!
+ * \brief Checks the scan converted mask of Polygon against its point test.
+ */
+class TestPolygon : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void square();
+    void triangle();
+    void concave();
+    void self_intersecting();
+    void hole();
+    void vertices_on_samples();
+    void outside();
+
+private:
+    static Polygon make(std::vector<QVector3D> vertices);
+    static void check(Polygon& polygon, int width, int height);
+};
+
+Polygon TestPolygon::make(std::vector<QVector3D> vertices)
+{
+    Polygon polygon;
+    polygon.set_vertices(0, std::move(vertices));
+    return polygon;
+}
+
+/*!
+ * \brief Every sample point (i/width, j/height) must be in a span of its row
+ * exactly when point_is_inside() holds for it.
+ */
+void TestPolygon::check(Polygon& polygon, int width, int height)
+{
+    polygon.build_edge_table(height);
+    std::vector<std::pair<int, int>> spans;
+    for (int j = 0; j < height; j++) {
+        polygon.row_spans(j, width, height, spans);
+        size_t span = 0;
+        for (int i = 0; i < width; i++) {
+            while (span < spans.size() && spans[span].second <= i)
+                span++;
+            const bool inside = span < spans.size() && spans[span].first <= i;
+            const bool expected = polygon.point_is_inside(i/(float)width, j/(float)height);
+            QVERIFY2(inside == expected, qPrintable(QString("sample %1, %2 of %3 x %4")
+                                                    .arg(i).arg(j).arg(width).arg(height)));
+        }
+    }
+}
+
+void TestPolygon::square()
+{
+    Polygon polygon = make({{0.2f, 0.2f, 0}, {0.8f, 0.2f, 0}, {0.8f, 0.8f, 0}, {0.2f, 0.8f, 0}});
+    check(polygon, 64, 64);
+    check(polygon, 37, 29);
+}
+
+void TestPolygon::triangle()
+{
+    Polygon polygon = make({{0.1f, 0.9f, 0}, {0.5f, 0.05f, 0}, {0.93f, 0.7f, 0}});
+    check(polygon, 64, 64);
+    check(polygon, 101, 13);
+}
+
+void TestPolygon::concave()
+{
+    // a U shape, with two spans on the rows through its arms
+    Polygon polygon = make({{0.1f, 0.1f, 0}, {0.9f, 0.1f, 0}, {0.9f, 0.9f, 0}, {0.7f, 0.9f, 0},
+                            {0.7f, 0.3f, 0}, {0.3f, 0.3f, 0}, {0.3f, 0.9f, 0}, {0.1f, 0.9f, 0}});
+    check(polygon, 64, 64);
+    check(polygon, 50, 71);
+}
+
+void TestPolygon::self_intersecting()
+{
+    // a bow tie and a five-pointed star, filled with the even-odd rule
+    Polygon bow_tie = make({{0.1f, 0.1f, 0}, {0.9f, 0.9f, 0}, {0.9f, 0.1f, 0}, {0.1f, 0.9f, 0}});
+    check(bow_tie, 64, 64);
+
+    std::vector<QVector3D> star;
+    for (int k = 0; k < 5; k++) {
+        const float angle = (float) (k * 4 * M_PI / 5);
+        star.push_back(QVector3D(0.5f + 0.4f * std::sin(angle), 0.5f - 0.4f * std::cos(angle), 0));
+    }
+    Polygon polygon = make(star);
+    check(polygon, 64, 64);
+    check(polygon, 93, 47);
+}
+
+void TestPolygon::hole()
+{
+    // outer ring and hole joined end to end, as imported annotations are
+    Polygon polygon = make({{0.1f, 0.1f, 0}, {0.9f, 0.1f, 0}, {0.9f, 0.9f, 0}, {0.1f, 0.9f, 0}, {0.1f, 0.1f, 0},
+                            {0.4f, 0.4f, 0}, {0.6f, 0.4f, 0}, {0.6f, 0.6f, 0}, {0.4f, 0.6f, 0}, {0.4f, 0.4f, 0}});
+    check(polygon, 64, 64);
+}
+
+void TestPolygon::vertices_on_samples()
+{
+    // edges and vertices lying exactly on sample rows and columns
+    Polygon polygon = make({{0.25f, 0.25f, 0}, {0.75f, 0.25f, 0}, {0.5f, 0.5f, 0},
+                            {0.75f, 0.75f, 0}, {0.25f, 0.75f, 0}});
+    check(polygon, 64, 64);
+    check(polygon, 8, 8);
+}
+
+void TestPolygon::outside()
+{
+    // partly off the volume, and no vertices at all
+    Polygon polygon = make({{-0.5f, -0.2f, 0}, {0.6f, 0.3f, 0}, {0.2f, 1.4f, 0}});
+    check(polygon, 64, 64);
+
+    Polygon empty = make({});
+    check(empty, 16, 16);
+}
+
+QTEST_APPLESS_MAIN(TestPolygon)
+
+#include "tst_polygon.moc"
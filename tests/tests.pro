@@ -0,0 +1,15 @@
+#-------------------------------------------------
+#
+# Unit tests; run them with "make check".
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    annotations \
+    cpuraycaster \
+    polygon \
+    tfcache \
+    tfcompute \
+    tfworker \
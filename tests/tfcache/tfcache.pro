@@ -0,0 +1,19 @@
+QT       += testlib gui
+
+TARGET = tst_tfcache
+CONFIG += testcase console
+CONFIG -= app_bundle
+
+gcc:QMAKE_CXXFLAGS += -std=c++17
+gcc:LIBS += -lGL
+
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_tfcache.cpp \
+    ../../src/texturestream.cpp \
+    ../../src/tfcache.cpp \
+
+HEADERS += \
+    ../../src/texturestream.h \
+    ../../src/tfcache.h \
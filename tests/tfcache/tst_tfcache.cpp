@@ -0,0 +1,139 @@
+#include <QtTest>
+
+#include <memory>
+
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+
+#include "texturestream.h"
+#include "tfcache.h"
+
+/*!
+ * \brief Checks that TFCache keeps only the settled state of a TF that is
+ * baked over and over while it is edited.
+ *
+ * Needs an OpenGL 4.3 context, for the texture copies; skipped otherwise.
+ */
+class TestTFCache : public QObject, protected QOpenGLExtraFunctions
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void store();
+    void deferred_edits();
+    void cancel_deferred();
+
+private:
+    static const int N = 16;
+
+    void bake(TextureStream& texture, uint8_t value);
+    uint8_t value(TextureStream& texture);
+
+    QOffscreenSurface m_surface;
+    QOpenGLContext m_context;
+};
+
+void TestTFCache::initTestCase()
+{
+    QSurfaceFormat format;
+    format.setVersion(4, 3);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    m_surface.setFormat(format);
+    m_surface.create();
+    m_context.setFormat(format);
+    if (!m_context.create() || !m_context.makeCurrent(&m_surface)
+            || m_context.format().version() < qMakePair(4, 3)) {
+        QSKIP("No OpenGL 4.3 context");
+    }
+    initializeOpenGLFunctions();
+}
+
+void TestTFCache::cleanupTestCase()
+{
+    m_context.doneCurrent();
+}
+
+/*!
+ * \brief Stand-in for a TF bake: fill the whole texture with \p value.
+ */
+void TestTFCache::bake(TextureStream& texture, uint8_t value)
+{
+    const std::vector<uint8_t> cells((size_t) N * N * N, value);
+    texture.upload(GL_R8, N, N, N, GL_RED, GL_UNSIGNED_BYTE, cells.data());
+}
+
+/*!
+ * \brief Value the texture holds, once its uploads have completed.
+ */
+uint8_t TestTFCache::value(TextureStream& texture)
+{
+    glFinish();
+    std::vector<uint8_t> cells((size_t) N * N * N);
+    glBindTexture(GL_TEXTURE_3D, texture.texture());
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_3D, 0, GL_RED, GL_UNSIGNED_BYTE, cells.data());
+    glBindTexture(GL_TEXTURE_3D, 0);
+    return cells[cells.size() / 2];
+}
+
+void TestTFCache::store()
+{
+    TFCache cache((size_t) 4 * N * N * N);
+    TextureStream texture(GL_TEXTURE_3D, GL_LINEAR, GL_CLAMP_TO_EDGE);
+    bake(texture, 10);
+    cache.store(1, texture, GL_TEXTURE_3D, GL_R8, N, N, N, (size_t) N * N * N);
+    bake(texture, 20);
+
+    QVERIFY(cache.restore(1, texture));
+    QCOMPARE(value(texture), (uint8_t) 10);
+    QVERIFY(!cache.restore(2, texture));
+}
+
+/*!
+ * \brief A stream of edits, each baked and deferred, stores only the last
+ * state once they settle, and leaves the entries cached before in place.
+ */
+void TestTFCache::deferred_edits()
+{
+    // room for two TFs: each intermediate state stored would evict the first
+    TFCache cache((size_t) 2 * N * N * N);
+    TextureStream texture(GL_TEXTURE_3D, GL_LINEAR, GL_CLAMP_TO_EDGE);
+    bake(texture, 1);
+    cache.store(1, texture, GL_TEXTURE_3D, GL_R8, N, N, N, (size_t) N * N * N);
+
+    for (uint8_t edit = 2; edit <= 20; edit++) {
+        bake(texture, edit);
+        cache.defer_store(edit, texture, GL_TEXTURE_3D, GL_R8, N, N, N, (size_t) N * N * N);
+    }
+    cache.store_deferred();
+    // nothing left to store
+    bake(texture, 99);
+    cache.store_deferred();
+
+    for (uint8_t edit = 2; edit < 20; edit++) {
+        QVERIFY(!cache.restore(edit, texture));
+    }
+    QVERIFY(cache.restore(20, texture));
+    QCOMPARE(value(texture), (uint8_t) 20);
+    QVERIFY(cache.restore(1, texture));
+    QCOMPARE(value(texture), (uint8_t) 1);
+}
+
+void TestTFCache::cancel_deferred()
+{
+    TFCache cache((size_t) 4 * N * N * N);
+    TextureStream texture(GL_TEXTURE_3D, GL_LINEAR, GL_CLAMP_TO_EDGE);
+    bake(texture, 5);
+    cache.defer_store(5, texture, GL_TEXTURE_3D, GL_R8, N, N, N, (size_t) N * N * N);
+    // e.g. replaced by a cached TF, which no longer matches key 5
+    cache.cancel_deferred();
+    cache.store_deferred();
+    QVERIFY(!cache.restore(5, texture));
+}
+
+QTEST_MAIN(TestTFCache)
+
+#include "tst_tfcache.moc"
@@ -0,0 +1,28 @@
+QT       += testlib gui
+
+TARGET = tst_tfcompute
+CONFIG += testcase console
+CONFIG -= app_bundle
+
+gcc:QMAKE_CXXFLAGS += -std=c++17 -fopenmp
+gcc:LIBS += -fopenmp -lGL
+
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_tfcompute.cpp \
+    ../../src/coloroccupancy.cpp \
+    ../../src/polygon.cpp \
+    ../../src/texturestream.cpp \
+    ../../src/tfbaker.cpp \
+    ../../src/tfcompute.cpp \
+
+HEADERS += \
+    ../../src/coloroccupancy.h \
+    ../../src/polygon.h \
+    ../../src/texturestream.h \
+    ../../src/tfbaker.h \
+    ../../src/tfcompute.h \
+
+RESOURCES += \
+    ../../resources.qrc
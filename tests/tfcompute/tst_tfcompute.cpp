@@ -0,0 +1,152 @@
+#include <QtTest>
+
+#include <memory>
+
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+
+#include "texturestream.h"
+#include "tfbaker.h"
+#include "tfcompute.h"
+
+/*!
+ * \brief Checks that the compute shader bakes the same colour TF, cell for
+ * cell, as the CPU.
+ *
+ * Needs an OpenGL 4.3 context; on hosts without a GPU, Mesa's llvmpipe
+ * (e.g. with QT_QPA_PLATFORM=offscreen) provides one. Skipped otherwise.
+ */
+class TestTFCompute : public QObject, protected QOpenGLExtraFunctions
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void full_bake();
+    void partial_bake();
+    void no_picks();
+
+private:
+    static std::vector<ColorTF> picks();
+    int differing_cells(TextureStream& texture, const std::vector<ColorTF>& tfs, int n);
+
+    QOffscreenSurface m_surface;
+    QOpenGLContext m_context;
+    std::unique_ptr<TFCompute> m_compute;
+};
+
+void TestTFCompute::initTestCase()
+{
+    QSurfaceFormat format;
+    format.setVersion(4, 3);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    m_surface.setFormat(format);
+    m_surface.create();
+    m_context.setFormat(format);
+    if (!m_context.create() || !m_context.makeCurrent(&m_surface)
+            || m_context.format().version() < qMakePair(4, 3)) {
+        QSKIP("No OpenGL 4.3 context");
+    }
+    initializeOpenGLFunctions();
+
+    m_compute = std::make_unique<TFCompute>();
+    QVERIFY(m_compute->valid());
+}
+
+void TestTFCompute::cleanupTestCase()
+{
+    m_compute.reset();
+    m_context.doneCurrent();
+}
+
+/*!
+ * \brief Overlapping picks of various sizes and opacities, including some
+ * that leave the TF alone (opacity 1, negative radius) and one that covers
+ * the whole RGB cube.
+ */
+std::vector<ColorTF> TestTFCompute::picks()
+{
+    std::vector<ColorTF> tfs;
+    for (int i = 0; i < 24; i++) {
+        tfs.push_back({i, qRgb((i*37) % 256, (i*91) % 256, (i*53) % 256),
+                       10 + (i*7) % 60, (i % 10) / 10.0f + 0.033f * (i % 3)});
+    }
+    tfs.push_back({24, qRgb(0, 0, 0), 0, 0.5f});
+    tfs.push_back({25, qRgb(255, 255, 255), 300, 0.77f});
+    tfs.push_back({26, qRgb(128, 64, 32), 40, 1.0f});
+    tfs.push_back({27, qRgb(32, 64, 128), -1, 0.2f});
+    return tfs;
+}
+
+/*!
+ * \brief Number of cells of \p texture that differ from the CPU bake of
+ * \p tfs.
+ */
+int TestTFCompute::differing_cells(TextureStream& texture, const std::vector<ColorTF>& tfs, int n)
+{
+    // let a full bake complete, so that texture() swaps it in
+    glFinish();
+    std::vector<uint8_t> gpu((size_t) n * n * n);
+    glBindTexture(GL_TEXTURE_3D, texture.texture());
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_3D, 0, GL_RED, GL_UNSIGNED_BYTE, gpu.data());
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    std::vector<uint8_t> cpu((size_t) n * n * n);
+    bake_color_proximity_tf(tfs, n, cpu.data());
+
+    int differing = 0;
+    for (size_t i = 0; i < cpu.size(); i++)
+        differing += cpu[i] != gpu[i];
+    return differing;
+}
+
+void TestTFCompute::full_bake()
+{
+    const std::vector<ColorTF> tfs = picks();
+    // the TF size of the app, and one that work groups do not divide
+    for (int n : {256, 36}) {
+        TextureStream texture(GL_TEXTURE_3D, GL_LINEAR, GL_CLAMP_TO_EDGE);
+        m_compute->bake_color_proximity_tf(tfs, n, texture, TFBox {0, 0, 0, n, n, n});
+        QCOMPARE(differing_cells(texture, tfs, n), 0);
+        QVERIFY(!texture.pending());
+    }
+}
+
+void TestTFCompute::partial_bake()
+{
+    const int n = 64;
+    std::vector<ColorTF> tfs = picks();
+    TextureStream texture(GL_TEXTURE_3D, GL_LINEAR, GL_CLAMP_TO_EDGE);
+    m_compute->bake_color_proximity_tf(tfs, n, texture, TFBox {0, 0, 0, n, n, n});
+    QCOMPARE(differing_cells(texture, tfs, n), 0);
+
+    // move a pick and change its opacity: only the cells it left and the
+    // ones it reaches now are baked again
+    const TFBox before = color_tf_footprint(tfs[3], n);
+    tfs[3].rgb = qRgb(200, 30, 90);
+    tfs[3].opacity = 0.35f;
+    const TFBox box = before.united(color_tf_footprint(tfs[3], n));
+    m_compute->bake_color_proximity_tf(tfs, n, texture, box);
+    QCOMPARE(differing_cells(texture, tfs, n), 0);
+
+    // a pick removed
+    const TFBox removed = color_tf_footprint(tfs[5], n);
+    tfs.erase(tfs.begin() + 5);
+    m_compute->bake_color_proximity_tf(tfs, n, texture, removed);
+    QCOMPARE(differing_cells(texture, tfs, n), 0);
+}
+
+void TestTFCompute::no_picks()
+{
+    const int n = 16;
+    TextureStream texture(GL_TEXTURE_3D, GL_LINEAR, GL_CLAMP_TO_EDGE);
+    m_compute->bake_color_proximity_tf({}, n, texture, TFBox {0, 0, 0, n, n, n});
+    QCOMPARE(differing_cells(texture, {}, n), 0);
+}
+
+QTEST_MAIN(TestTFCompute)
+
+#include "tst_tfcompute.moc"
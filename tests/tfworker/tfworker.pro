@@ -0,0 +1,23 @@
+QT       += testlib
+QT       -= gui
+
+TARGET = tst_tfworker
+CONFIG += testcase console
+CONFIG -= app_bundle
+
+gcc:QMAKE_CXXFLAGS += -std=c++17 -fopenmp
+gcc:LIBS += -fopenmp -pthread
+
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_tfworker.cpp \
+    ../../src/coloroccupancy.cpp \
+    ../../src/polygon.cpp \
+    ../../src/tfbaker.cpp \
+
+HEADERS += \
+    ../../src/coloroccupancy.h \
+    ../../src/polygon.h \
+    ../../src/tfbaker.h \
+    ../../src/tfworker.h \
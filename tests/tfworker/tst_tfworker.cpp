@@ -0,0 +1,137 @@
+#include <QtTest>
+
+#include <chrono>
+#include <thread>
+
+#include "tfworker.h"
+
+/*!
+ * \brief Checks which results TFWorker publishes, in particular that a
+ * cancelled job never reaches collect().
+ */
+class TestTFWorker : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void collect_result();
+    void latest_job_wins();
+    void cancel_after_bake();
+    void cancel_while_publishing();
+
+private:
+    // the baked "TF": the id of the job that wrote it
+    struct Buffer {
+        int job {0};
+    };
+
+    static const TFBox BOX;
+
+    static TFWorker<Buffer>::Job job(int id, std::function<void()> after_bake = nullptr);
+    static bool wait_idle(TFWorker<Buffer>& worker);
+};
+
+const TFBox TestTFWorker::BOX {0, 0, 0, 1, 1, 1};
+
+/*!
+ * \brief Job writing \p id to the buffer, then calling \p after_bake.
+ */
+TFWorker<TestTFWorker::Buffer>::Job TestTFWorker::job(int id, std::function<void()> after_bake)
+{
+    return [id, after_bake](Buffer& buffer, const TFBox& box, const std::atomic<bool>&) {
+        buffer.job = id;
+        if (after_bake)
+            after_bake();
+        return box;
+    };
+}
+
+/*!
+ * \brief Wait until no job is queued or running.
+ * \return False on timeout.
+ */
+bool TestTFWorker::wait_idle(TFWorker<Buffer>& worker)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (worker.pending()) {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+void TestTFWorker::collect_result()
+{
+    TFWorker<Buffer> worker;
+    worker.submit(BOX, job(1));
+    QVERIFY(wait_idle(worker));
+    QVERIFY(worker.busy());
+
+    int collected = 0;
+    QVERIFY(worker.collect([&](const Buffer& buffer, const TFBox&) { collected = buffer.job; }));
+    QCOMPARE(collected, 1);
+    QVERIFY(!worker.busy());
+    QVERIFY(!worker.collect([](const Buffer&, const TFBox&) {}));
+}
+
+void TestTFWorker::latest_job_wins()
+{
+    TFWorker<Buffer> worker;
+    for (int id = 1; id <= 100; id++)
+        worker.submit(BOX, job(id));
+    QVERIFY(wait_idle(worker));
+
+    int collected = 0;
+    QVERIFY(worker.collect([&](const Buffer& buffer, const TFBox&) { collected = buffer.job; }));
+    QCOMPARE(collected, 100);
+}
+
+/*!
+ * \brief A cancel() landing once the bake has returned, before its result is
+ * published, drops the result: the GL thread may have restored another TF
+ * in the meantime.
+ */
+void TestTFWorker::cancel_after_bake()
+{
+    TFWorker<Buffer> worker;
+    worker.submit(BOX, job(1, [&worker]() { worker.cancel(); }));
+    QVERIFY(wait_idle(worker));
+    QVERIFY(!worker.busy());
+    QVERIFY(!worker.collect([](const Buffer&, const TFBox&) {}));
+
+    // and the next job still publishes
+    worker.submit(BOX, job(2));
+    QVERIFY(wait_idle(worker));
+    QVERIFY(worker.collect([](const Buffer&, const TFBox&) {}));
+}
+
+/*!
+ * \brief cancel() racing the end of a job, many times over: once cancel()
+ * has returned, the job's result never becomes collectable.
+ */
+void TestTFWorker::cancel_while_publishing()
+{
+    TFWorker<Buffer> worker;
+    for (int i = 0; i < 20000; i++) {
+        // the job ends a varying time after signalling, so that cancel()
+        // lands anywhere from inside the bake to after its end
+        std::atomic<bool> baked {false};
+        std::atomic<int> spin {0};
+        worker.submit(BOX, job(i, [&baked, &spin, i]() {
+            baked = true;
+            for (int k = 0; k < i % 64; k++)
+                spin++;
+        }));
+        while (!baked)
+            std::this_thread::yield();
+        worker.cancel();
+        QVERIFY(wait_idle(worker));
+        QVERIFY2(!worker.collect([](const Buffer&, const TFBox&) {}),
+                 qPrintable(QString("stale result published at iteration %1").arg(i)));
+    }
+}
+
+QTEST_APPLESS_MAIN(TestTFWorker)
+
+#include "tst_tfworker.moc"